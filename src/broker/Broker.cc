@@ -1,18 +1,40 @@
 #include "broker/Broker.hh"
 #include "utils/Utils.hh"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <set>
+#include <thread>
 #include <memory>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <future>
 #include <sstream>
 
 namespace Broker
 {
   const std::string CONFIG_FILENAME = "broker.conf";
-
-  Broker::Broker(const std::string& base_path)
-    : base_path_(base_path), config_manager_(base_path + "/config")
+  const std::string CHECKPOINT_FILENAME = "recovery-point-checkpoint";
+  const int32_t CHECKPOINT_VERSION = 0;
+  const int64_t DEFAULT_FETCH_BYTES = 1024 * 1024;
+  const int64_t MAX_FETCH_BYTES = 3 * 1024 * 1024; // Stay below the 4MB grpc limit
+
+  Broker::Broker(const std::string& base_path, int64_t max_open_segments,
+                 int32_t nb_writers)
+    : base_path_(base_path), topics_(std::make_shared<const topics_type>()),
+      config_manager_(base_path + "/config"),
+      segment_cache_(max_open_segments > 0 ?
+                     std::make_shared<CommitLog::SegmentCache>(max_open_segments) : nullptr),
+      next_watch_id_(0), nb_watchers_(0)
   {
+    if (nb_writers <= 0)
+      nb_writers = std::max(1u, std::thread::hardware_concurrency());
+    for (int32_t i = 0; i < nb_writers; ++i)
+      writers_.emplace_back(new Writer());
   }
 
   Broker::~Broker()
@@ -21,51 +43,113 @@ namespace Broker
   }
 
   mykafka::Error
-  Broker::createAndAddNewPartition(const std::string& path, const std::string& topic,
+  Broker::createAndAddNewPartition(topics_type& topics,
+                                   const std::string& path, const std::string& topic,
                                    int32_t partition_id, int64_t max_segment_size,
-                                   int64_t max_partition_size, int64_t segment_ttl)
+                                   int64_t max_partition_size, int64_t segment_ttl,
+                                   int64_t index_interval_bytes,
+                                   int64_t flush_messages, int64_t flush_ms)
   {
     auto partition = std::make_shared<CommitLog::Partition>(path,
                                                             max_segment_size,
                                                             max_partition_size,
-                                                            segment_ttl);
+                                                            segment_ttl,
+                                                            index_interval_bytes,
+                                                            segment_cache_,
+                                                            flush_messages,
+                                                            flush_ms);
     auto res = partition->open();
     if (res.code() != mykafka::Error::OK)
       return res;
 
-    auto& entry = topics_[{topic, partition_id}];
+    addPartition(topics, topic, partition_id, partition);
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  void
+  Broker::addPartition(topics_type& topics, const std::string& topic, int32_t partition_id,
+                       const std::shared_ptr<CommitLog::Partition>& partition)
+  {
+    auto& entry = topics[{topic, partition_id}];
     entry.leader_id = 0; // Not used
     entry.preferred_leader_id = 0; // Not used
     entry.replicas.clear(); // Not used
     entry.isr.clear(); // Not used
     entry.partition = partition;
-
-    return Utils::err(mykafka::Error::OK);
   }
 
   mykafka::Error
-  Broker::load()
+  Broker::load(int32_t nb_threads)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
-
+    const auto start = std::chrono::steady_clock::now();
     std::cout << "Loading all topics/partition from " << base_path_ << std::endl;
-    auto res = config_manager_.load();
-    if (res.code() != mykafka::Error::OK)
-      return res;
 
-    int32_t nb = 0;
-    for (auto& cfg : config_manager_)
+    std::vector<std::pair<Utils::ConfigManager::TopicPartition,
+                          Utils::ConfigManager::RawInfo> > configs;
     {
-      res = createAndAddNewPartition(base_path_ + "/" + cfg.first.toString(),
-                                     cfg.first.topic, cfg.first.partition,
-                                     cfg.second.info.max_segment_size,
-                                     cfg.second.info.max_partition_size,
-                                     cfg.second.info.segment_ttl);
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      auto res = config_manager_.load();
       if (res.code() != mykafka::Error::OK)
         return res;
-      ++nb;
+      for (auto& cfg : config_manager_)
+        configs.emplace_back(cfg.first, cfg.second.info);
     }
-    std::cout << "Load " << nb << " partitions!" << std::endl;
+
+    recovery_points_type recovery_points;
+    auto res = readCheckpoint(recovery_points);
+    if (res.code() != mykafka::Error::OK)
+      return res;
+
+    // Partitions are opened in parallel, without the broker lock. The
+    // threads left (if few partitions) are used to open their segments.
+    const int64_t nb = configs.size();
+    if (nb_threads <= 0)
+      nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    const int32_t nb_segment_threads = std::max<int64_t>(1, nb_threads / std::max<int64_t>(1, nb));
+    std::vector<std::shared_ptr<CommitLog::Partition> > partitions(nb);
+    std::vector<mykafka::Error> results(nb);
+    std::atomic<int32_t> nb_recovered(0);
+    Utils::parallelFor(nb, nb_threads, [&](int64_t i)
+                       {
+                         const auto& key = configs[i].first;
+                         const auto& info = configs[i].second;
+                         CommitLog::Partition::RecoveryPoint recovery_point{-1, -1, -1};
+                         auto found = recovery_points.find(key);
+                         if (found != recovery_points.cend())
+                         {
+                           recovery_point = found->second;
+                           ++nb_recovered;
+                         }
+                         partitions[i] = std::make_shared<CommitLog::Partition>
+                           (base_path_ + "/" + key.toString(), info.max_segment_size,
+                            info.max_partition_size, info.segment_ttl,
+                            info.index_interval_bytes, segment_cache_,
+                            info.flush_messages, info.flush_ms);
+                         results[i] = partitions[i]->open(recovery_point, nb_segment_threads);
+                       });
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    auto topics = std::make_shared<topics_type>(*topicsSnapshot());
+    int64_t nb_segments = 0;
+    for (int64_t i = 0; i < nb; ++i)
+    {
+      if (results[i].code() != mykafka::Error::OK)
+        return results[i];
+      addPartition(*topics, configs[i].first.topic, configs[i].first.partition, partitions[i]);
+      nb_segments += partitions[i]->nbSegments();
+      if (partitions[i]->truncatedBytes() > 0)
+        std::cout << "Truncate " << partitions[i]->truncatedBytes() << " invalid bytes"
+                  << " (torn writes) from partition " << configs[i].first.toString()
+                  << std::endl;
+    }
+    publish(topics);
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+      (std::chrono::steady_clock::now() - start).count();
+    std::cout << "Load " << nb << " partitions (" << nb_segments << " segments, "
+              << nb_recovered << " from checkpoint) in " << elapsed << "ms using "
+              << std::min<int64_t>(nb_threads, nb) << " threads!" << std::endl;
 
     return Utils::err(mykafka::Error::OK);
   }
@@ -73,83 +157,106 @@ namespace Broker
   mykafka::Error
   Broker::createPartition(mykafka::TopicPartitionRequest& request)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
+    boost::lock_guard<boost::mutex> lock(mutex_);
 
     const Utils::ConfigManager::TopicPartition key{request.topic(), request.partition()};
     const std::string strkey = request.topic() + "-" + std::to_string(request.partition());
-    auto found = topics_.find(key);
-    if (found != topics_.cend())
+    auto topics = std::make_shared<topics_type>(*topicsSnapshot());
+    auto found = topics->find(key);
+    if (found != topics->cend())
       return Utils::err(mykafka::Error::TOPIC_ERROR,
                         "The topic/partition " + strkey + " already exists!");
 
-    auto res = createAndAddNewPartition(base_path_ + "/" + strkey,
+    auto res = createAndAddNewPartition(*topics, base_path_ + "/" + strkey,
                                         request.topic(), request.partition(),
                                         request.max_segment_size(),
                                         request.max_partition_size(),
-                                        request.segment_ttl());
+                                        request.segment_ttl(),
+                                        request.index_interval_bytes(),
+                                        request.flush_messages(),
+                                        request.flush_ms());
     if (res.code() != mykafka::Error::OK)
       return res;
 
-    return config_manager_.create(key,
-                                  request.max_segment_size(),
-                                  request.max_partition_size(),
-                                  request.segment_ttl());
+    // The config (and its commit offset) must exist before the partition is visible.
+    res = config_manager_.create(key,
+                                 request.max_segment_size(),
+                                 request.max_partition_size(),
+                                 request.segment_ttl(),
+                                 request.index_interval_bytes(),
+                                 request.flush_messages(),
+                                 request.flush_ms());
+    if (res.code() != mykafka::Error::OK)
+      return res;
+    publish(topics);
+
+    return Utils::err(mykafka::Error::OK);
   }
 
   mykafka::Error
   Broker::deletePartition(mykafka::TopicPartitionRequest& request)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
+    boost::lock_guard<boost::mutex> lock(mutex_);
 
     const Utils::ConfigManager::TopicPartition key{request.topic(), request.partition()};
     const std::string strkey = request.topic() + "-" + std::to_string(request.partition());
-    auto found = topics_.find(key);
-    if (found == topics_.cend())
+    auto topics = std::make_shared<topics_type>(*topicsSnapshot());
+    auto found = topics->find(key);
+    if (found == topics->cend())
       return Utils::err(mykafka::Error::TOPIC_ERROR,
                         "The topic " + strkey + " don't exists!");
 
-    auto res = found->second.partition->deletePartition();
+    // Unpublish first: operations still holding the partition get an error.
+    auto partition = found->second.partition;
+    topics->erase(found);
+    publish(topics);
+    auto res = partition->deletePartition();
+    if (res.code() != mykafka::Error::OK)
+      return res;
+
+    res = config_manager_.remove(key);
     if (res.code() != mykafka::Error::OK)
       return res;
-    topics_.erase(found);
 
-    return config_manager_.remove(key);
+    return writeCheckpoint(*topics);
   }
 
   mykafka::Error
   Broker::deleteTopic(mykafka::TopicPartitionRequest& request)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
-
-    std::vector<iterator> delete_list;
+    boost::lock_guard<boost::mutex> lock(mutex_);
 
-    auto end = topics_.end();
-    for (auto entry = topics_.begin(); entry != end; ++entry)
+    auto topics = std::make_shared<topics_type>(*topicsSnapshot());
+    std::vector<std::pair<int32_t, std::shared_ptr<CommitLog::Partition> > > delete_list;
+    for (auto entry = topics->begin(); entry != topics->end();)
     {
       if (entry->first.topic == request.topic())
       {
-        auto res = entry->second.partition->deletePartition();
-        if (res.code() != mykafka::Error::OK)
-          return res;
-        res = config_manager_.remove({request.topic(), entry->first.partition});
-        if (res.code() != mykafka::Error::OK)
-          return res;
-        delete_list.push_back(entry);
+        delete_list.emplace_back(entry->first.partition, entry->second.partition);
+        entry = topics->erase(entry);
       }
+      else
+        ++entry;
     }
+    publish(topics);
 
     for (auto& entry : delete_list)
-      topics_.erase(entry);
+    {
+      auto res = entry.second->deletePartition();
+      if (res.code() != mykafka::Error::OK)
+        return res;
+      res = config_manager_.remove({request.topic(), entry.first});
+      if (res.code() != mykafka::Error::OK)
+        return res;
+    }
 
-    return Utils::err(mykafka::Error::OK);
+    return writeCheckpoint(*topics);
   }
 
   void
   Broker::getTopicInfo(mykafka::Void&,
                        mykafka::BrokerInfoResponse& response)
   {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-
     std::ostringstream buff;
     dump(buff);
     response.set_dump(buff.str());
@@ -164,113 +271,489 @@ namespace Broker
   {
     const Utils::ConfigManager::TopicPartition key{request.topic(), request.partition()};
     auto error = response.mutable_error();
+    auto partition = findPartition(key);
+    if (!partition)
     {
-      boost::shared_lock<boost::shared_mutex> lock(mutex_);
-
       const std::string strkey = request.topic() + "-" + std::to_string(request.partition());
-      auto found = topics_.find(key);
-      if (found == topics_.cend())
-      {
-        error->set_code(mykafka::Error::TOPIC_ERROR);
-        error->set_msg("The topic " + strkey + " don't exists!");
-        return;
-      }
-
-      response.set_first_offset(found->second.partition->oldestOffset());
-      response.set_last_offset(found->second.partition->newestOffset() - 1);
+      error->set_code(mykafka::Error::TOPIC_ERROR);
+      error->set_msg("The topic " + strkey + " don't exists!");
+      return;
     }
 
-    Utils::ConfigManager::RawInfo info;
-    auto res = config_manager_.get(key, info);
-    error->set_code(res.code());
-    error->set_msg(res.msg());
-
-    if (res.code() == mykafka::Error::OK)
-      response.set_commit_offset(info.commit_offset);
+    response.set_first_offset(partition->oldestOffset());
+    response.set_last_offset(partition->newestOffset() - 1);
+    response.set_commit_offset(partition->commitOffset());
+    error->set_code(mykafka::Error::OK);
+    error->set_msg("");
   }
 
   void
   Broker::getMessage(mykafka::GetMessageRequest& request,
                      mykafka::GetMessageResponse& response)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
-
     const Utils::ConfigManager::TopicPartition key{request.topic(), request.partition()};
     auto error = response.mutable_error();
 
-    Utils::ConfigManager::RawInfo info;
-    auto res = config_manager_.get(key, info);
-    if (res.code() != mykafka::Error::OK)
+    const std::string strkey = request.topic() + "-" + std::to_string(request.partition());
+    auto partition = findPartition(key);
+    if (!partition)
     {
-      error->set_code(res.code());
-      error->set_msg(res.msg());
+      error->set_code(mykafka::Error::TOPIC_ERROR);
+      error->set_msg("The topic " + strkey + " don't exists!");
       return;
     }
 
-    if (request.offset() > info.commit_offset)
+    if (request.offset() > partition->commitOffset())
     {
       error->set_code(mykafka::Error::NO_MESSAGE);
       error->set_msg("No more messages available!");
       return;
     }
 
+    auto res = partition->readAt(*response.mutable_payload(), request.offset());
+    error->set_code(res.code());
+    error->set_msg(res.msg());
+  }
+
+  void
+  Broker::getMessages(mykafka::GetMessagesRequest& request,
+                      mykafka::GetMessagesResponse& response)
+  {
+    const Utils::ConfigManager::TopicPartition key{request.topic(), request.partition()};
+    auto error = response.mutable_error();
+
     const std::string strkey = request.topic() + "-" + std::to_string(request.partition());
-    auto found = topics_.find(key);
-    if (found == topics_.cend())
+    auto partition = findPartition(key);
+    if (!partition)
     {
       error->set_code(mykafka::Error::TOPIC_ERROR);
       error->set_msg("The topic " + strkey + " don't exists!");
       return;
     }
 
-    std::vector<char> payload;
-    res = found->second.partition->readAt(payload, request.offset());
+    const int64_t commit_offset = partition->commitOffset();
+    if (request.offset() > commit_offset)
+    {
+      error->set_code(mykafka::Error::NO_MESSAGE);
+      error->set_msg("No more messages available!");
+      return;
+    }
+
+    int64_t max_bytes = request.max_bytes() > 0 ? request.max_bytes() : DEFAULT_FETCH_BYTES;
+    max_bytes = std::min(max_bytes, MAX_FETCH_BYTES);
+    int64_t max_messages = commit_offset - request.offset() + 1;
+    if (request.max_messages() > 0)
+      max_messages = std::min(max_messages, request.max_messages());
+
+    std::shared_ptr<const char> data;
+    std::vector<CommitLog::Segment::Record> records;
+    auto res = partition->readRange(data, records, request.offset(), max_bytes, max_messages);
     error->set_code(res.code());
     error->set_msg(res.msg());
-    response.set_payload(std::string(payload.begin(), payload.end()));
+    if (res.code() != mykafka::Error::OK)
+      return;
+
+    // Payloads are copied once, from the log mapping (or the read
+    // buffer of the active segment) into the response.
+    response.mutable_records()->Reserve(records.size());
+    for (auto& record : records)
+    {
+      auto rec = response.add_records();
+      rec->set_offset(record.offset);
+      rec->set_payload(data.get() + record.position, record.size);
+    }
   }
 
   void
   Broker::sendMessage(mykafka::SendMessageRequest& request,
-                      mykafka::SendMessageResponse& response)
+                      mykafka::SendMessageResponse& response,
+                      const std::function<void()>& done)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
-
     const Utils::ConfigManager::TopicPartition key{request.topic(), request.partition()};
     const std::string strkey = request.topic() + "-" + std::to_string(request.partition());
     auto error = response.mutable_error();
-    int64_t offset = 0;
 
-    auto found = topics_.find(key);
-    if (found == topics_.cend())
+    auto partition = findPartition(key);
+    if (!partition)
     {
       error->set_code(mykafka::Error::TOPIC_ERROR);
       error->set_msg("The topic " + strkey + " don't exists!");
+      done();
       return;
     }
 
-    std::vector<char> payload(request.payload().begin(), request.payload().end());
-    auto res = found->second.partition->write(payload, offset);
-    error->set_code(res.code());
-    error->set_msg(res.msg());
-    if (res.code() != mykafka::Error::OK)
+    std::vector<std::vector<char> > payloads(1);
+    payloads[0].assign(request.payload().begin(), request.payload().end());
+    submit(key, partition, std::move(payloads),
+           [&response, done](const mykafka::Error& res, int64_t offset) {
+             auto error = response.mutable_error();
+             error->set_code(res.code());
+             error->set_msg(res.msg());
+             if (res.code() == mykafka::Error::OK)
+               response.set_offset(offset);
+             done();
+           });
+  }
+
+  void
+  Broker::sendMessage(mykafka::SendMessageRequest& request,
+                      mykafka::SendMessageResponse& response)
+  {
+    std::promise<void> written;
+    sendMessage(request, response, [&written]() { written.set_value(); });
+    written.get_future().wait();
+  }
+
+  void
+  Broker::sendMessages(mykafka::SendMessagesRequest& request,
+                       mykafka::SendMessagesResponse& response,
+                       const std::function<void()>& done)
+  {
+    // Results are created upfront: each append fills its own.
+    auto error = response.mutable_error();
+    error->set_code(mykafka::Error::OK);
+    error->set_msg("");
+    for (auto& batch : request.batches())
+    {
+      auto result = response.add_results();
+      result->set_topic(batch.topic());
+      result->set_partition(batch.partition());
+    }
+
+    // The last one to finish (including this thread) completes the response.
+    auto pending = std::make_shared<std::atomic<int32_t> >(request.batches_size() + 1);
+    auto finish = [&response, done, pending]() {
+      if (--*pending != 0)
+        return;
+      auto error = response.mutable_error();
+      for (auto& result : response.results())
+        if (result.error().code() != mykafka::Error::OK)
+        {
+          *error = result.error();
+          break;
+        }
+      done();
+    };
+
+    for (int32_t i = 0; i < request.batches_size(); ++i)
+    {
+      auto& batch = request.batches(i);
+      auto result = response.mutable_results(i);
+      const Utils::ConfigManager::TopicPartition key{batch.topic(), batch.partition()};
+      const std::string strkey = batch.topic() + "-" + std::to_string(batch.partition());
+
+      auto partition = findPartition(key);
+      if (!partition)
+      {
+        auto batch_error = result->mutable_error();
+        batch_error->set_code(mykafka::Error::TOPIC_ERROR);
+        batch_error->set_msg("The topic " + strkey + " don't exists!");
+        finish();
+        continue;
+      }
+
+      std::vector<std::vector<char> > payloads;
+      payloads.reserve(batch.payloads_size());
+      for (auto& payload : batch.payloads())
+        payloads.emplace_back(payload.begin(), payload.end());
+      const int64_t nb = payloads.size();
+      submit(key, partition, std::move(payloads),
+             [result, nb, finish](const mykafka::Error& res, int64_t first_offset) {
+               auto batch_error = result->mutable_error();
+               batch_error->set_code(res.code());
+               batch_error->set_msg(res.msg());
+               result->set_base_offset(first_offset);
+               result->set_last_offset(first_offset + nb - 1);
+               finish();
+             });
+    }
+    finish();
+  }
+
+  void
+  Broker::sendMessages(mykafka::SendMessagesRequest& request,
+                       mykafka::SendMessagesResponse& response)
+  {
+    std::promise<void> written;
+    sendMessages(request, response, [&written]() { written.set_value(); });
+    written.get_future().wait();
+  }
+
+  void
+  Broker::submit(const Utils::ConfigManager::TopicPartition& key,
+                 const std::shared_ptr<CommitLog::Partition>& partition,
+                 std::vector<std::vector<char> >&& payloads,
+                 const Writer::callback_type& callback)
+  {
+    const int64_t nb = payloads.size();
+    auto& writer = *writers_[Utils::Hash<Utils::ConfigManager::TopicPartition>()(key) %
+                             writers_.size()];
+    writer.submit(Writer::Append{partition, std::move(payloads),
+          [this, key, partition, nb, callback](const mykafka::Error& res, int64_t first_offset) {
+            if (res.code() == mykafka::Error::OK && nb > 0)
+            {
+              const int64_t last_offset = first_offset + nb - 1;
+              partition->setCommitOffset(last_offset);
+              notifyWatchers(key, last_offset);
+            }
+            callback(res, first_offset);
+          }});
+  }
+
+  std::shared_ptr<const Broker::topics_type>
+  Broker::topicsSnapshot() const
+  {
+    return std::atomic_load(&topics_);
+  }
+
+  void
+  Broker::publish(const std::shared_ptr<const topics_type>& topics)
+  {
+    std::atomic_store(&topics_, topics);
+  }
+
+  std::shared_ptr<CommitLog::Partition>
+  Broker::findPartition(const Utils::ConfigManager::TopicPartition& key) const
+  {
+    auto topics = topicsSnapshot();
+    auto found = topics->find(key);
+    if (found == topics->cend())
+      return nullptr;
+    return found->second.partition;
+  }
+
+  void
+  Broker::watch(const std::string& topic, int32_t partition, int64_t offset,
+                int64_t& id, const std::function<void()>& callback)
+  {
+    const Utils::ConfigManager::TopicPartition key{topic, partition};
+    boost::lock_guard<boost::mutex> lock(watchers_mutex_);
+
+    // Writers update the commit offset, then check nb_watchers_. Counting
+    // this watch before checking the commit offset ensures no write is missed.
+    id = next_watch_id_++;
+    ++nb_watchers_;
+    auto found = findPartition(key);
+    if (!found || offset <= found->commitOffset())
+    {
+      --nb_watchers_;
+      callback();
       return;
+    }
 
-    res = config_manager_.updateCommitOffset(key, offset);
-    error->set_code(res.code());
-    error->set_msg(res.msg());
+    watchers_[key][id] = Watcher{offset, callback};
+  }
+
+  void
+  Broker::unwatch(const std::string& topic, int32_t partition, int64_t id)
+  {
+    const Utils::ConfigManager::TopicPartition key{topic, partition};
+    boost::lock_guard<boost::mutex> lock(watchers_mutex_);
+
+    auto found = watchers_.find(key);
+    if (found == watchers_.end())
+      return;
+    nb_watchers_ -= found->second.erase(id);
+    if (found->second.empty())
+      watchers_.erase(found);
+  }
+
+  void
+  Broker::notifyWatchers(const Utils::ConfigManager::TopicPartition& key, int64_t commit_offset)
+  {
+    // Nobody waits: don't take the watchers lock on the write path.
+    if (nb_watchers_ == 0)
+      return;
+
+    boost::lock_guard<boost::mutex> lock(watchers_mutex_);
+
+    auto found = watchers_.find(key);
+    if (found == watchers_.end())
+      return;
 
-    response.set_offset(offset);
+    auto& watchers = found->second;
+    for (auto it = watchers.begin(); it != watchers.end();)
+    {
+      if (it->second.offset <= commit_offset)
+      {
+        it->second.callback();
+        it = watchers.erase(it);
+        --nb_watchers_;
+      }
+      else
+        ++it;
+    }
+    if (watchers.empty())
+      watchers_.erase(found);
+  }
+
+  mykafka::Error
+  Broker::checkpoint()
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    return writeCheckpoint(*topicsSnapshot());
+  }
+
+  mykafka::Error
+  Broker::flush()
+  {
+    // An error doesn't prevent the other partitions from being flushed.
+    auto res = Utils::err(mykafka::Error::OK);
+    for (auto& entry : *topicsSnapshot())
+    {
+      auto local_res = entry.second.partition->flushIfDue();
+      if (local_res.code() != mykafka::Error::OK)
+        res = local_res;
+    }
+
+    return res;
+  }
+
+  mykafka::Error
+  Broker::prepareSegments()
+  {
+    auto res = Utils::err(mykafka::Error::OK);
+    for (auto& entry : *topicsSnapshot())
+    {
+      auto local_res = entry.second.partition->prepareNextSegment();
+      if (local_res.code() != mykafka::Error::OK)
+        res = local_res;
+    }
+
+    return res;
+  }
+
+  mykafka::Error
+  Broker::cleanOldSegments(int64_t max_bytes_per_sec)
+  {
+    // Partitions are cleaned one by one, so the limit is global.
+    auto res = Utils::err(mykafka::Error::OK);
+    for (auto& entry : *topicsSnapshot())
+    {
+      auto local_res = entry.second.partition->cleanOldSegments(max_bytes_per_sec);
+      if (local_res.code() != mykafka::Error::OK)
+        res = local_res;
+    }
+
+    return res;
+  }
+
+  mykafka::Error
+  Broker::writeCheckpoint(const topics_type& topics)
+  {
+    // Commit offsets live in the partitions, the config is only a copy.
+    for (auto& entry : topics)
+    {
+      auto res = config_manager_.updateCommitOffset(entry.first,
+                                                    entry.second.partition->commitOffset());
+      if (res.code() != mykafka::Error::OK)
+        return res;
+    }
+
+    // A recovery point is only saved once its log is on the disk: it is
+    // taken first, then the partition is flushed, with the segments
+    // rolled since the last flush (a roll doesn't sync).
+    std::ostringstream out;
+    out << CHECKPOINT_VERSION << "\n" << topics.size() << "\n";
+    for (auto& entry : topics)
+    {
+      const auto recovery_point = entry.second.partition->recoveryPoint();
+      auto res = entry.second.partition->flush();
+      if (res.code() != mykafka::Error::OK)
+        return res;
+      out << entry.first.partition << " " << recovery_point.base_offset << " "
+          << recovery_point.next_offset << " " << recovery_point.size << " "
+          << entry.first.topic << "\n";
+    }
+
+    // Never leave a partially written checkpoint behind.
+    boost::lock_guard<boost::mutex> checkpoint_lock(checkpoint_mutex_);
+    const std::string filename = base_path_ + "/" + CHECKPOINT_FILENAME;
+    const std::string tmp_filename = filename + ".tmp";
+    const std::string content = out.str();
+    const int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't open checkpoint " +
+                        tmp_filename + " because: " + std::string(::strerror(errno)));
+    if (::write(fd, content.data(), content.size()) != static_cast<ssize_t>(content.size()) ||
+        ::fsync(fd) < 0)
+    {
+      const std::string error(::strerror(errno));
+      ::close(fd);
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't write checkpoint " +
+                        tmp_filename + " because: " + error);
+    }
+    if (::close(fd) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't close checkpoint " +
+                        tmp_filename + " because: " + std::string(::strerror(errno)));
+    if (::rename(tmp_filename.c_str(), filename.c_str()) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't rename checkpoint " +
+                        tmp_filename + " because: " + std::string(::strerror(errno)));
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Broker::readCheckpoint(recovery_points_type& recovery_points) const
+  {
+    const std::string filename = base_path_ + "/" + CHECKPOINT_FILENAME;
+    std::ifstream in(filename);
+    if (!in)
+      return Utils::err(mykafka::Error::OK); // No checkpoint, check everything
+
+    int32_t version = -1;
+    int64_t nb = 0;
+    in >> version >> nb;
+    if (!in || version != CHECKPOINT_VERSION)
+    {
+      std::cout << "Ignore invalid checkpoint " << filename << std::endl;
+      return Utils::err(mykafka::Error::OK);
+    }
+
+    for (int64_t i = 0; i < nb; ++i)
+    {
+      Utils::ConfigManager::TopicPartition key;
+      CommitLog::Partition::RecoveryPoint recovery_point;
+      in >> key.partition >> recovery_point.base_offset
+         >> recovery_point.next_offset >> recovery_point.size;
+      in.ignore(1);
+      std::getline(in, key.topic);
+      if (!in)
+      {
+        std::cout << "Ignore invalid checkpoint " << filename << std::endl;
+        recovery_points.clear();
+        return Utils::err(mykafka::Error::OK);
+      }
+      if (recovery_point.base_offset >= 0)
+        recovery_points[key] = recovery_point;
+    }
+
+    return Utils::err(mykafka::Error::OK);
   }
 
   mykafka::Error
   Broker::close()
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
+    // Finish the appends in progress first.
+    for (auto& writer : writers_)
+      writer->sync();
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    // Already closed!
+    auto topics = topicsSnapshot();
+    if (topics->empty())
+      return config_manager_.close();
+
+    auto res = writeCheckpoint(*topics);
+    if (res.code() != mykafka::Error::OK)
+      return res;
 
-    for (auto& entry : topics_)
+    publish(std::make_shared<topics_type>());
+    for (auto& entry : *topics)
     {
-      auto res = entry.second.partition->close();
+      res = entry.second.partition->close();
       if (res.code() != mykafka::Error::OK)
         return res;
     }
@@ -281,10 +764,8 @@ namespace Broker
   int32_t
   Broker::nbTopics() const
   {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-
     std::set<std::string> set;
-    for (auto& entry : topics_)
+    for (auto& entry : *topicsSnapshot())
       set.insert(entry.first.topic);
     return set.size();
   }
@@ -292,16 +773,26 @@ namespace Broker
   int32_t
   Broker::nbPartitions() const
   {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return topicsSnapshot()->size();
+  }
 
-    return topics_.size();
+  void
+  Broker::writerStats(int64_t& nb_appends, int64_t& nb_writes) const
+  {
+    nb_appends = 0;
+    nb_writes = 0;
+    for (auto& writer : writers_)
+    {
+      nb_appends += writer->nbAppends();
+      nb_writes += writer->nbWrites();
+    }
   }
 
   void
   Broker::dump(std::ostream& out) const
   {
     out << "== Topics/Partitions ==\n";
-    for (auto& entry : topics_)
+    for (auto& entry : *topicsSnapshot())
       out << entry.first.toString() << ": "
           << "leader: " << entry.second.leader_id
           << ", pref_leader:" << entry.second.preferred_leader_id
@@ -311,6 +802,16 @@ namespace Broker
           << ", oldestOffset: " << entry.second.partition->oldestOffset()
           << ", size: " << entry.second.partition->physicalSize()
           << std::endl;
+    if (segment_cache_)
+      out << "== Segment cache ==\n"
+          << "open sealed segments: " << segment_cache_->size()
+          << "/" << segment_cache_->maxOpenSegments() << std::endl;
+    int64_t nb_appends = 0;
+    int64_t nb_writes = 0;
+    writerStats(nb_appends, nb_writes);
+    out << "== Writers ==\n"
+        << "writers: " << writers_.size() << ", appends: " << nb_appends
+        << ", writes: " << nb_writes << std::endl;
     out << "== Config ==\n";
     config_manager_.dump(out);
   }
@@ -1,10 +1,15 @@
 #ifndef BROKER_BROKER_HH_
 # define BROKER_BROKER_HH_
 
+# include "broker/Writer.hh"
 # include "commitlog/Partition.hh"
 # include "utils/ConfigManager.hh"
 
-# include <boost/thread/shared_mutex.hpp>
+# include <boost/thread/mutex.hpp>
+# include <atomic>
+# include <functional>
+# include <map>
+# include <memory>
 # include <unordered_map>
 # include <vector>
 # include <inttypes.h>
@@ -17,6 +22,11 @@ namespace Broker
   ** This class hold a list of partition
   ** with their information.
   **
+  ** The list is an immutable snapshot: data operations load it
+  ** without any lock, then only contend on their partition.
+  ** Admin operations (create, delete, load, close) are serialized,
+  ** and publish a modified copy of the list.
+  **
   ** @verbatim
   ** Topic:bookstore
   **         partition 0:
@@ -40,16 +50,31 @@ namespace Broker
   class Broker
   {
   public:
-    Broker(const std::string& base_path);
+    /*!
+    ** Initialize a broker.
+    **
+    ** @param base_path The log directory.
+    ** @param max_open_segments Max number of sealed segments keeping
+    **          their files open, shared by all partitions (0 = no limit).
+    ** @param nb_writers The number of writer threads, each one owning
+    **          a shard of the partitions (0 = nb machine core).
+    */
+    Broker(const std::string& base_path, int64_t max_open_segments = 0,
+           int32_t nb_writers = 0);
     ~Broker();
 
     /*!
     ** Load all config files, then all partitions
     ** present in the config files.
+    ** Partitions (and their segments) are opened by a pool
+    ** of nb_threads threads, then added all at once.
+    **
+    ** @param nb_threads The max number of loading threads
+    **          (0 = nb machine core).
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
-    mykafka::Error load();
+    mykafka::Error load(int32_t nb_threads = 0);
 
     /*!
     ** Create a partition on the given topic.
@@ -57,7 +82,8 @@ namespace Broker
     **
     ** @param request The client request
     **        (needed: topic, partition, max_segment_size,
-    **        max_partition_size, segment_ttl).
+    **        max_partition_size, segment_ttl, index_interval_bytes,
+    **        flush_messages, flush_ms).
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
@@ -113,10 +139,63 @@ namespace Broker
     void getMessage(mykafka::GetMessageRequest& request,
                     mykafka::GetMessageResponse& response);
 
+    /*!
+    ** Get contiguous messages from the selected topic/partition,
+    ** starting at the requested offset. Read at most max_bytes
+    ** (default and upper bound: 1MB and 3MB) and max_messages
+    ** (0 means no limit), never past the commit offset.
+    ** At least one message is returned if available.
+    **
+    ** @param request The client request.
+    ** @param response The response to give to the client.
+    */
+    void getMessages(mykafka::GetMessagesRequest& request,
+                     mykafka::GetMessagesResponse& response);
+
+    /*!
+    ** Call callback once a message is available at the given offset
+    ** (commit offset reached), at once if it's already the case.
+    ** Used to park a get message(s) call until new data arrives.
+    ** The callback is called at most once, and must not block.
+    **
+    ** @param topic The topic.
+    ** @param partition The partition.
+    ** @param offset The offset waited for.
+    ** @param id The watch id, for unwatch (set before any callback call).
+    ** @param callback The function to call.
+    */
+    void watch(const std::string& topic, int32_t partition, int64_t offset,
+               int64_t& id, const std::function<void()>& callback);
+
+    /*!
+    ** Remove a watch if not triggered yet. Once returned,
+    ** its callback won't be called anymore.
+    **
+    ** @param topic The topic.
+    ** @param partition The partition.
+    ** @param id The watch id.
+    */
+    void unwatch(const std::string& topic, int32_t partition, int64_t id);
+
     /*!
     ** Write a message to the selected topic/partition.
     ** If topic/partition not exists, an error will be
     ** filled into the response.
+    ** The append is handed to the writer owning the partition,
+    ** and done is called (by the writer thread, or at once on
+    ** error) once the response is filled. The request can be
+    ** destroyed as soon as the call returns.
+    **
+    ** @param request The client request.
+    ** @param response The response to give to the client.
+    ** @param done Called once the response is filled.
+    */
+    void sendMessage(mykafka::SendMessageRequest& request,
+                     mykafka::SendMessageResponse& response,
+                     const std::function<void()>& done);
+
+    /*!
+    ** Synchronous sendMessage: wait for the response.
     **
     ** @param request The client request.
     ** @param response The response to give to the client.
@@ -125,7 +204,80 @@ namespace Broker
                      mykafka::SendMessageResponse& response);
 
     /*!
-    ** Close all partition and config files.
+    ** Write batches of messages to their topic/partition.
+    ** Each batch is appended in one operation, and gets its own
+    ** result (in request order) with the offset of its first message.
+    ** The global error is the first batch error, if any.
+    ** Batches are handed to the writers owning their partition,
+    ** and done is called once they are all written.
+    **
+    ** @param request The client request.
+    ** @param response The response to give to the client.
+    ** @param done Called once the response is filled.
+    */
+    void sendMessages(mykafka::SendMessagesRequest& request,
+                      mykafka::SendMessagesResponse& response,
+                      const std::function<void()>& done);
+
+    /*!
+    ** Synchronous sendMessages: wait for the response.
+    **
+    ** @param request The client request.
+    ** @param response The response to give to the client.
+    */
+    void sendMessages(mykafka::SendMessagesRequest& request,
+                      mykafka::SendMessagesResponse& response);
+
+    /*!
+    ** Save the recovery point of every partition into a checkpoint
+    ** file (written aside, then renamed), and the commit offsets
+    ** into the config (only kept in memory otherwise). On load, segments before
+    ** a recovery point are trusted, and only the log after it is
+    ** checked, so each partition (with the segments rolled since its
+    ** last flush) is synced, out of its lock, before its recovery point
+    ** is saved. Should be called periodically, so a crash only
+    ** rescans what was written since the last checkpoint.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error checkpoint();
+
+    /*!
+    ** Flush the partitions with a flush_ms policy, if due.
+    ** Should be called periodically (every few ms) by a background
+    ** flusher: appends are acknowledged without waiting for it.
+    ** Partitions with a flush_messages policy are flushed by their
+    ** writer, before acknowledging.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error flush();
+
+    /*!
+    ** Open the next segment of every partition ahead, so that
+    ** rolls don't create segments on the write path.
+    ** Should be called periodically by a background thread.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error prepareSegments();
+
+    /*!
+    ** Apply the retention (segment ttl and max partition size) of
+    ** every partition, idle ones included. Producers never wait for
+    ** the deletions. Should be called periodically by a background
+    ** janitor thread.
+    **
+    ** @param max_bytes_per_sec Limit the deletion rate, for all
+    **          the partitions (0 = no limit).
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error cleanOldSegments(int64_t max_bytes_per_sec = 0);
+
+    /*!
+    ** Write a last checkpoint (clean shutdown), then close all
+    ** partition and config files.
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
@@ -145,6 +297,15 @@ namespace Broker
     */
     int32_t nbPartitions() const;
 
+    /*!
+    ** Get the writers activity: the number of appends, and the
+    ** number of partition writes done for them (group commit).
+    **
+    ** @param nb_appends The number of appends.
+    ** @param nb_writes The number of writes.
+    */
+    void writerStats(int64_t& nb_appends, int64_t& nb_writes) const;
+
     /*!
     ** Dump the entire broker info into a stream.
     **
@@ -152,42 +313,147 @@ namespace Broker
     */
     void dump(std::ostream& out) const;
 
+  private:
+    struct PartitionInfo
+    {
+      int32_t leader_id;
+      int32_t preferred_leader_id;
+      std::vector<std::string> replicas;
+      std::vector<std::string> isr;
+      std::shared_ptr<CommitLog::Partition> partition;
+    };
+    typedef std::unordered_map<Utils::ConfigManager::TopicPartition,
+                               PartitionInfo,
+                               Utils::Hash<Utils::ConfigManager::TopicPartition> > topics_type;
+    typedef std::unordered_map<Utils::ConfigManager::TopicPartition,
+                               CommitLog::Partition::RecoveryPoint,
+                               Utils::Hash<Utils::ConfigManager::TopicPartition> >
+    recovery_points_type;
+    struct Watcher
+    {
+      int64_t offset;
+      std::function<void()> callback;
+    };
+    typedef std::unordered_map<Utils::ConfigManager::TopicPartition,
+                               std::map<int64_t, Watcher>,
+                               Utils::Hash<Utils::ConfigManager::TopicPartition> > watchers_type;
+
   private:
     /*!
     ** Create a new partition, and add it to the topics list.
     **
+    ** @param topics The topics list.
     ** @param path The physical path of the partition.
     ** @param topic The topic name.
     ** @param partition_id The partition number.
     ** @param max_segment_size Max size per segment.
     ** @param max_partition_size Max total partition size allowed.
     ** @param segment_ttl Life duration of a segment.
+    ** @param index_interval_bytes Bytes of log between two index entries.
+    ** @param flush_messages Flush every N messages (0 = disabled).
+    ** @param flush_ms Flush every N ms (0 = disabled).
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
-    mykafka::Error createAndAddNewPartition(const std::string& path,  const std::string& topic,
+    mykafka::Error createAndAddNewPartition(topics_type& topics,
+                                            const std::string& path,  const std::string& topic,
                                             int32_t partition_id, int64_t max_segment_size,
-                                            int64_t max_partition_size, int64_t segment_ttl);
+                                            int64_t max_partition_size, int64_t segment_ttl,
+                                            int64_t index_interval_bytes,
+                                            int64_t flush_messages, int64_t flush_ms);
 
-  private:
-    struct PartitionInfo
-    {
-      int32_t leader_id;
-      int32_t preferred_leader_id;
-      std::vector<std::string> replicas;
-      std::vector<std::string> isr;
-      std::shared_ptr<CommitLog::Partition> partition;
-    };
-    typedef std::unordered_map<Utils::ConfigManager::TopicPartition,
-                               PartitionInfo,
-                               Utils::Hash<Utils::ConfigManager::TopicPartition> > topics_type;
-    typedef topics_type::iterator iterator;
+    /*!
+    ** Add an opened partition to the topics list.
+    **
+    ** @param topics The topics list.
+    ** @param topic The topic name.
+    ** @param partition_id The partition number.
+    ** @param partition The partition.
+    */
+    void addPartition(topics_type& topics, const std::string& topic, int32_t partition_id,
+                      const std::shared_ptr<CommitLog::Partition>& partition);
+
+    /*!
+    ** Get the current topics list. Never blocks, and stays
+    ** valid even if a newer list is published.
+    **
+    ** @return The topics list.
+    */
+    std::shared_ptr<const topics_type> topicsSnapshot() const;
+
+    /*!
+    ** Replace the topics list.
+    ** @warning Must be called with the admin lock held.
+    **
+    ** @param topics The new topics list.
+    */
+    void publish(const std::shared_ptr<const topics_type>& topics);
+
+    /*!
+    ** Find a partition in the current topics list.
+    **
+    ** @param key The topic/partition.
+    **
+    ** @return The partition, or null if not found.
+    */
+    std::shared_ptr<CommitLog::Partition>
+    findPartition(const Utils::ConfigManager::TopicPartition& key) const;
+
+    /*!
+    ** Hand payloads to the writer owning their partition. Once
+    ** written, the commit offset is updated and watchers notified,
+    ** then callback is called (by the writer thread).
+    **
+    ** @param key The topic/partition.
+    ** @param partition The partition.
+    ** @param payloads The payloads to append.
+    ** @param callback Called with the error and the first offset.
+    */
+    void submit(const Utils::ConfigManager::TopicPartition& key,
+                const std::shared_ptr<CommitLog::Partition>& partition,
+                std::vector<std::vector<char> >&& payloads,
+                const Writer::callback_type& callback);
+
+    /*!
+    ** Call (and remove) the watches satisfied by a new commit offset.
+    **
+    ** @param key The topic/partition.
+    ** @param commit_offset The new commit offset.
+    */
+    void notifyWatchers(const Utils::ConfigManager::TopicPartition& key, int64_t commit_offset);
+
+    /*!
+    ** Save the commit offsets into the config, then write
+    ** the checkpoint file.
+    ** @warning Must be called with the admin lock held.
+    **
+    ** @param topics The topics list to save.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error writeCheckpoint(const topics_type& topics);
+
+    /*!
+    ** Read the checkpoint file, if any.
+    **
+    ** @param recovery_points The recovery point per topic/partition.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error readCheckpoint(recovery_points_type& recovery_points) const;
 
   private:
     const std::string base_path_;
-    topics_type topics_;
+    std::shared_ptr<const topics_type> topics_; // Use atomic load/store
     Utils::ConfigManager config_manager_;
-    mutable boost::shared_mutex mutex_;
+    std::shared_ptr<CommitLog::SegmentCache> segment_cache_;
+    boost::mutex mutex_; // Admin operations
+    mutable boost::mutex checkpoint_mutex_;
+    watchers_type watchers_;
+    int64_t next_watch_id_;
+    std::atomic<int64_t> nb_watchers_;
+    boost::mutex watchers_mutex_;
+    std::vector<std::unique_ptr<Writer> > writers_; // Stopped first
   };
 } // Broker
 
@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <atomic>
 #include <iomanip>
+#include <random>
 
 namespace
 {
@@ -181,6 +182,16 @@ int main()
             << std::endl
             << "Elapsed time: " << elapsed_ms << " ms " << std::endl;
 
+  // Concurrent writes to the partition are combined by its writer.
+  int64_t nb_appends = 0;
+  int64_t nb_writes = 0;
+  broker.writerStats(nb_appends, nb_writes);
+  std::cout << nb_appends << " appends in " << nb_writes << " writes"
+            << " (" << std::fixed << std::setprecision(1)
+            << static_cast<double>(nb_appends) / std::max<int64_t>(1, nb_writes)
+            << " appends per write with " << nb_core << " writer threads)"
+            << std::endl;
+
   broker.close();
 
   return 0;
@@ -9,6 +9,9 @@
 #include "boost_test_helper.hh"
 
 #include <inttypes.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <thread>
 #include <array>
 
@@ -321,6 +324,154 @@ BOOST_AUTO_TEST_CASE(test_offset)
 
   res = broker.close();
   BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // The commit offset is saved into the config on close.
+  Utils::ConfigManager config(tmp_path + "/config");
+  res = config.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  Utils::ConfigManager::RawInfo info;
+  res = config.get({topic, partition}, info);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(info.commit_offset, 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_write_batch, Setup)
+{
+  const std::string topic = "test_batch";
+  createOnePartition(topic, 0);
+
+  Broker::Broker broker(tmp_path);
+  auto res = broker.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  mykafka::SendMessagesRequest request;
+  for (int32_t i = 0; i < 2; ++i)
+  {
+    auto batch = request.add_batches();
+    batch->set_topic(topic);
+    batch->set_partition(0);
+    for (int32_t j = 0; j < 10; ++j)
+      batch->add_payloads("some data");
+  }
+  auto bad_batch = request.add_batches();
+  bad_batch->set_topic(topic);
+  bad_batch->set_partition(42);
+  bad_batch->add_payloads("lost");
+
+  mykafka::SendMessagesResponse response;
+  broker.sendMessages(request, response);
+  BOOST_CHECK_EQUAL(response.error().code(), mykafka::Error::TOPIC_ERROR);
+  BOOST_REQUIRE_EQUAL(response.results_size(), 3);
+  BOOST_CHECK_EQUAL(response.results(0).error().code(), mykafka::Error::OK);
+  BOOST_CHECK_EQUAL(response.results(0).base_offset(), 0);
+  BOOST_CHECK_EQUAL(response.results(1).error().code(), mykafka::Error::OK);
+  BOOST_CHECK_EQUAL(response.results(1).base_offset(), 10);
+  BOOST_CHECK_EQUAL(response.results(1).last_offset(), 19);
+  BOOST_CHECK_EQUAL(response.results(2).error().code(), mykafka::Error::TOPIC_ERROR);
+  BOOST_CHECK_EQUAL(response.results(2).partition(), 42);
+
+  readFrom(broker, topic, 0, 19, 1);
+
+  mykafka::GetOffsetsRequest offsets_request;
+  offsets_request.set_topic(topic);
+  offsets_request.set_partition(0);
+  mykafka::GetOffsetsResponse offsets_response;
+  broker.getOffsets(offsets_request, offsets_response);
+  BOOST_CHECK_EQUAL(offsets_response.commit_offset(), 19);
+  BOOST_CHECK_EQUAL(offsets_response.last_offset(), 19);
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_async_send, Setup)
+{
+  const std::string topic = "test_async";
+  const int32_t nb = 100;
+  createOnePartition(topic, 0);
+  createOnePartition(topic, 1);
+
+  Broker::Broker broker(tmp_path, 0, 2);
+  auto res = broker.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // Appends of a partition are done in order, by its writer.
+  std::vector<mykafka::SendMessageResponse> responses(nb * 2);
+  std::atomic<int32_t> nb_done(0);
+  for (int32_t i = 0; i < nb * 2; ++i)
+  {
+    mykafka::SendMessageRequest request;
+    request.set_topic(topic);
+    request.set_partition(i % 2);
+    request.set_payload("some data");
+    broker.sendMessage(request, responses[i], [&nb_done]() { ++nb_done; });
+  }
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(nb_done, nb * 2);
+  int64_t nb_appends = 0;
+  int64_t nb_writes = 0;
+  broker.writerStats(nb_appends, nb_writes);
+  BOOST_CHECK_EQUAL(nb_appends, nb * 2);
+  BOOST_CHECK_LE(nb_writes, nb_appends);
+  for (int32_t i = 0; i < nb * 2; ++i)
+  {
+    BOOST_CHECK_EQUAL(responses[i].error().code(), mykafka::Error::OK);
+    BOOST_CHECK_EQUAL(responses[i].offset(), i / 2);
+  }
+}
+
+BOOST_FIXTURE_TEST_CASE(test_read_range, Setup)
+{
+  const std::string topic = "test_range";
+  createOnePartition(topic, 0);
+
+  Broker::Broker broker(tmp_path);
+  auto res = broker.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  writeFrom(broker, topic, 0, "some data", 20);
+
+  mykafka::GetMessagesRequest request;
+  request.set_topic(topic);
+  request.set_partition(0);
+  request.set_offset(5);
+  request.set_max_messages(10);
+  mykafka::GetMessagesResponse response;
+  broker.getMessages(request, response);
+  BOOST_CHECK_EQUAL_MSG(response.error().code(), mykafka::Error::OK, response.error().msg());
+  BOOST_REQUIRE_EQUAL(response.records_size(), 10);
+  for (int32_t i = 0; i < response.records_size(); ++i)
+  {
+    BOOST_CHECK_EQUAL(response.records(i).offset(), 5 + i);
+    BOOST_CHECK_EQUAL(response.records(i).payload(), "some data");
+  }
+
+  // Never past the commit offset
+  response.Clear();
+  request.set_offset(15);
+  request.set_max_messages(0);
+  broker.getMessages(request, response);
+  BOOST_CHECK_EQUAL_MSG(response.error().code(), mykafka::Error::OK, response.error().msg());
+  BOOST_CHECK_EQUAL(response.records_size(), 5);
+
+  // Bounded by max_bytes, but at least one message
+  response.Clear();
+  request.set_offset(0);
+  request.set_max_bytes(1);
+  broker.getMessages(request, response);
+  BOOST_CHECK_EQUAL_MSG(response.error().code(), mykafka::Error::OK, response.error().msg());
+  BOOST_CHECK_EQUAL(response.records_size(), 1);
+
+  response.Clear();
+  request.set_offset(20);
+  broker.getMessages(request, response);
+  BOOST_CHECK_EQUAL(response.error().code(), mykafka::Error::NO_MESSAGE);
+  BOOST_CHECK_EQUAL(response.records_size(), 0);
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
 }
 
 // ============================
@@ -386,3 +537,280 @@ BOOST_FIXTURE_TEST_CASE(test_many_parallel_add_partition, Setup)
   auto res = broker.close();
   BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
 }
+
+BOOST_FIXTURE_TEST_CASE(test_admin_while_writing, Setup)
+{
+  const std::string topic = "admin_while_writing";
+  createOnePartition(topic, 0);
+
+  Broker::Broker broker(tmp_path);
+  auto res = broker.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // Data operations never wait for the admin ones.
+  std::thread admin([&broker,topic]() {
+      for (int32_t i = 1; i < 50; ++i)
+      {
+        mykafka::TopicPartitionRequest request;
+        request.set_topic(topic);
+        request.set_max_segment_size(4096);
+        request.set_partition(i);
+        auto res = broker.createPartition(request);
+        BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+        if (i % 2 == 0)
+        {
+          res = broker.deletePartition(request);
+          BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+        }
+      }
+    });
+  std::thread reader([&broker,topic]() {
+      writeFrom(broker, topic, 0, "some data", 1);
+      readFrom(broker, topic, 0, 0, 500);
+    });
+  writeFrom(broker, topic, 0, "some data", 500);
+  admin.join();
+  reader.join();
+
+  BOOST_CHECK_EQUAL(broker.nbPartitions(), 26);
+  readFrom(broker, topic, 0, 500, 1);
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_checkpoint, Setup)
+{
+  const std::string topic = "test_checkpoint";
+  createOnePartition(topic, 0);
+  createOnePartition(topic, 1);
+
+  mykafka::SendMessageRequest request;
+  request.set_topic(topic);
+  request.set_partition(0);
+  request.set_payload("some data");
+  mykafka::SendMessageResponse response;
+
+  {
+    Broker::Broker broker(tmp_path);
+    auto res = broker.load();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    writeFrom(broker, topic, 0, "some data", 200);
+    res = broker.checkpoint();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK(fs::exists(tmp_path + "/recovery-point-checkpoint"));
+    writeFrom(broker, topic, 0, "some data", 1);
+    res = broker.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+
+  Broker::Broker broker(tmp_path);
+  auto res = broker.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(broker.nbPartitions(), 2);
+  broker.sendMessage(request, response);
+  res = response.error();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(response.offset(), 201);
+  readFrom(broker, topic, 0, 0, 202);
+
+  // A deleted partition leaves the checkpoint.
+  mykafka::TopicPartitionRequest delete_request;
+  delete_request.set_topic(topic);
+  delete_request.set_partition(0);
+  res = broker.deletePartition(delete_request);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  std::ifstream in(tmp_path + "/recovery-point-checkpoint");
+  const std::string content((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+  BOOST_CHECK_EQUAL(content, "0\n1\n1 0 0 0 " + topic + "\n");
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_flush_policy, Setup)
+{
+  const std::string topic = "test_flush";
+  {
+    Broker::Broker broker(tmp_path);
+    mykafka::TopicPartitionRequest request;
+    request.set_topic(topic);
+    request.set_max_segment_size(4096);
+    request.set_partition(0);
+    request.set_flush_messages(1);
+    auto res = broker.createPartition(request);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    request.set_partition(1);
+    request.set_flush_messages(0);
+    request.set_flush_ms(1);
+    res = broker.createPartition(request);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+    writeFrom(broker, topic, 0, "some data", 10);
+    writeFrom(broker, topic, 1, "some data", 10);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    res = broker.flush();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    res = broker.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+
+  // The policy is kept in the config.
+  Utils::ConfigManager config(tmp_path + "/config");
+  auto res = config.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  Utils::ConfigManager::RawInfo info;
+  res = config.get({topic, 0}, info);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(info.flush_messages, 1);
+  BOOST_CHECK_EQUAL(info.flush_ms, 0);
+  res = config.get({topic, 1}, info);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(info.flush_messages, 0);
+  BOOST_CHECK_EQUAL(info.flush_ms, 1);
+  res = config.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  Broker::Broker broker(tmp_path);
+  res = broker.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  readFrom(broker, topic, 0, 0, 10);
+  readFrom(broker, topic, 1, 0, 10);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_prepare_segments, Setup)
+{
+  const std::string topic = "test_prepare";
+  createOnePartition(topic, 0);
+
+  Broker::Broker broker(tmp_path);
+  auto res = broker.load();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  res = broker.prepareSegments();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK(fs::exists(tmp_path + "/" + topic + "-0/spare.log"));
+
+  // 4096 bytes segments: the first roll uses the spare segment.
+  writeFrom(broker, topic, 0, "some data", 200);
+  BOOST_CHECK(!fs::exists(tmp_path + "/" + topic + "-0/spare.log"));
+  readFrom(broker, topic, 0, 0, 200);
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_clean_old_segments, Setup)
+{
+  const std::string topic = "test_retention";
+  Broker::Broker broker(tmp_path);
+  mykafka::TopicPartitionRequest request;
+  request.set_topic(topic);
+  request.set_partition(0);
+  request.set_max_segment_size(1024);
+  request.set_max_partition_size(2048);
+  auto res = broker.createPartition(request);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(broker, topic, 0, "some data", 500);
+
+  mykafka::GetOffsetsRequest offsets_request;
+  offsets_request.set_topic(topic);
+  offsets_request.set_partition(0);
+  mykafka::GetOffsetsResponse offsets_response;
+  broker.getOffsets(offsets_request, offsets_response);
+  BOOST_CHECK_EQUAL(offsets_response.first_offset(), 0);
+
+  // The partition is idle, its old segments still expire.
+  res = broker.cleanOldSegments();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  broker.getOffsets(offsets_request, offsets_response);
+  BOOST_CHECK(offsets_response.first_offset() > 0);
+  BOOST_CHECK_EQUAL(offsets_response.last_offset(), 499);
+  readFrom(broker, topic, 0, offsets_response.first_offset(),
+           500 - offsets_response.first_offset());
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_parallel_load, Setup)
+{
+  const std::string topic = "test_parallel_load";
+  {
+    Broker::Broker broker(tmp_path);
+    mykafka::TopicPartitionRequest request;
+    request.set_topic(topic);
+    request.set_max_segment_size(1024);
+    for (int32_t i = 0; i < 20; ++i)
+    {
+      request.set_partition(i);
+      auto res = broker.createPartition(request);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      writeFrom(broker, topic, i, "some data", 100 + i);
+    }
+    auto res = broker.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+
+  for (int32_t nb_threads : {1, 4})
+  {
+    Broker::Broker broker(tmp_path);
+    auto res = broker.load(nb_threads);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(broker.nbPartitions(), 20);
+    for (int32_t i = 0; i < 20; ++i)
+    {
+      mykafka::GetOffsetsRequest request;
+      request.set_topic(topic);
+      request.set_partition(i);
+      mykafka::GetOffsetsResponse response;
+      broker.getOffsets(request, response);
+      BOOST_CHECK_EQUAL(response.last_offset(), 99 + i);
+    }
+    res = broker.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+}
+
+BOOST_FIXTURE_TEST_CASE(test_watch, Setup)
+{
+  const std::string topic = "test_watch";
+  Broker::Broker broker(tmp_path);
+  mykafka::TopicPartitionRequest create_request;
+  create_request.set_topic(topic);
+  create_request.set_partition(0);
+  auto res = broker.createPartition(create_request);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(broker, topic, 0, "some data", 10);
+
+  // Data already there: called at once.
+  int32_t nb_calls = 0;
+  int64_t id = -1;
+  broker.watch(topic, 0, 9, id, [&nb_calls]() { ++nb_calls; });
+  BOOST_CHECK_EQUAL(nb_calls, 1);
+  BOOST_CHECK(id >= 0);
+
+  // Called once the offset is written, and only once.
+  int64_t first_id = -1;
+  int64_t second_id = -1;
+  int32_t nb_second_calls = 0;
+  broker.watch(topic, 0, 10, first_id, [&nb_calls]() { ++nb_calls; });
+  broker.watch(topic, 0, 11, second_id, [&nb_second_calls]() { ++nb_second_calls; });
+  BOOST_CHECK(first_id != second_id);
+  BOOST_CHECK_EQUAL(nb_calls, 1);
+  writeFrom(broker, topic, 0, "some data", 1);
+  BOOST_CHECK_EQUAL(nb_calls, 2);
+  BOOST_CHECK_EQUAL(nb_second_calls, 0);
+  writeFrom(broker, topic, 0, "some data", 1);
+  BOOST_CHECK_EQUAL(nb_calls, 2);
+  BOOST_CHECK_EQUAL(nb_second_calls, 1);
+
+  // Removed watches are never called.
+  broker.watch(topic, 0, 12, id, [&nb_calls]() { ++nb_calls; });
+  broker.unwatch(topic, 0, id);
+  writeFrom(broker, topic, 0, "some data", 1);
+  BOOST_CHECK_EQUAL(nb_calls, 2);
+
+  res = broker.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
@@ -0,0 +1,134 @@
+#include "broker/Writer.hh"
+#include "utils/Utils.hh"
+
+#include <future>
+#include <unordered_map>
+
+namespace Broker
+{
+  Writer::Writer()
+    : queue_(), stop_(false), nb_appends_(0), nb_writes_(0), mutex_(), wake_(), thread_()
+  {
+    thread_ = std::thread(&Writer::run, this);
+  }
+
+  Writer::~Writer()
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  void
+  Writer::submit(Append&& append)
+  {
+    // Only an empty queue may have a sleeping writer.
+    if (queue_.push(std::move(append)))
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      wake_.notify_one();
+    }
+  }
+
+  void
+  Writer::sync()
+  {
+    std::promise<void> done;
+    submit(Append{nullptr, {}, [&done](const mykafka::Error&, int64_t) { done.set_value(); }});
+    done.get_future().wait();
+  }
+
+  int64_t
+  Writer::nbAppends() const
+  {
+    return nb_appends_;
+  }
+
+  int64_t
+  Writer::nbWrites() const
+  {
+    return nb_writes_;
+  }
+
+  void
+  Writer::run()
+  {
+    std::vector<Append> appends;
+    while (true)
+    {
+      appends.clear();
+      queue_.popAll(appends);
+      if (appends.empty())
+      {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (queue_.empty() && !stop_)
+          wake_.wait(lock);
+        if (queue_.empty())
+          break;
+        continue;
+      }
+
+      // A sync is completed once the appends before it are.
+      std::vector<Append*> pending;
+      for (auto& append : appends)
+      {
+        if (append.partition)
+        {
+          pending.push_back(&append);
+          continue;
+        }
+        write(pending);
+        pending.clear();
+        append.callback(Utils::err(mykafka::Error::OK), -1);
+      }
+      write(pending);
+    }
+  }
+
+  void
+  Writer::write(const std::vector<Append*>& appends)
+  {
+    // Group the appends per partition, in order of first appearance.
+    std::vector<std::vector<Append*> > groups;
+    std::unordered_map<CommitLog::Partition*, size_t> group_of;
+    for (auto append : appends)
+    {
+      auto found = group_of.emplace(append->partition.get(), groups.size());
+      if (found.second)
+        groups.emplace_back();
+      groups[found.first->second].push_back(append);
+    }
+
+    for (auto& group : groups)
+    {
+      int64_t first_offset = -1;
+      mykafka::Error res;
+      if (group.size() == 1)
+        res = group[0]->partition->writeBatch(group[0]->payloads, first_offset);
+      else
+      {
+        size_t nb = 0;
+        for (auto append : group)
+          nb += append->payloads.size();
+        std::vector<std::vector<char> > payloads;
+        payloads.reserve(nb);
+        for (auto append : group)
+          for (auto& payload : append->payloads)
+            payloads.push_back(std::move(payload));
+        res = group[0]->partition->writeBatch(payloads, first_offset);
+      }
+      ++nb_writes_;
+      nb_appends_ += group.size();
+
+      // Each append gets its own slice of the offsets.
+      for (auto append : group)
+      {
+        append->callback(res, first_offset);
+        first_offset += append->payloads.size();
+      }
+    }
+  }
+} // Broker
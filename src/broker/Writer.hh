@@ -0,0 +1,117 @@
+#ifndef BROKER_WRITER_HH_
+# define BROKER_WRITER_HH_
+
+# include "commitlog/Partition.hh"
+# include "utils/MpscQueue.hh"
+
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/mutex.hpp>
+# include <atomic>
+# include <functional>
+# include <memory>
+# include <thread>
+# include <vector>
+
+namespace Broker
+{
+  /*!
+  ** @class Writer
+  **
+  ** A thread appending to the partitions it owns.
+  ** Appends are submitted through a lock-free queue, from any
+  ** thread, and are done in submission order. Their callbacks
+  ** are called by the writer thread, once written.
+  ** A partition must always be written by the same writer, so
+  ** its appends are serialized without waiting for a lock.
+  **
+  ** Appends submitted while the writer is busy are combined: all
+  ** the pending appends of a partition are written with a single
+  ** Partition::writeBatch (one writev and one index update), then
+  ** each one is completed with its own offsets (group commit).
+  */
+  class Writer
+  {
+  public:
+    /*!
+    ** Called once an append is done, with its error and
+    ** the offset of its first payload.
+    */
+    typedef std::function<void(const mykafka::Error&, int64_t)> callback_type;
+
+    /*!
+    ** @struct Append
+    **
+    ** Payloads to append to a partition.
+    */
+    struct Append
+    {
+      std::shared_ptr<CommitLog::Partition> partition;
+      std::vector<std::vector<char> > payloads;
+      callback_type callback;
+    };
+
+  public:
+    /*!
+    ** Start the writer thread.
+    */
+    Writer();
+
+    /*!
+    ** Write what is already submitted, then stop the thread.
+    */
+    ~Writer();
+
+    /*!
+    ** Submit an append. Never blocks.
+    **
+    ** @param append The append.
+    */
+    void submit(Append&& append);
+
+    /*!
+    ** Wait until everything submitted before is written.
+    */
+    void sync();
+
+    /*!
+    ** Get the number of appends done.
+    **
+    ** @return The number of appends.
+    */
+    int64_t nbAppends() const;
+
+    /*!
+    ** Get the number of partition writes done (several
+    ** appends can be combined in one write).
+    **
+    ** @return The number of writes.
+    */
+    int64_t nbWrites() const;
+
+  private:
+    /*!
+    ** Writer thread: append what is submitted, until stopped.
+    */
+    void run();
+
+    /*!
+    ** Write appends, combining the ones of the same partition,
+    ** then call their callbacks. Appends of a partition keep
+    ** their order.
+    **
+    ** @param appends The appends, none of them being a sync.
+    */
+    void write(const std::vector<Append*>& appends);
+
+  private:
+    Utils::MpscQueue<Append> queue_;
+    std::atomic<bool> stop_;
+    std::atomic<int64_t> nb_appends_;
+    std::atomic<int64_t> nb_writes_;
+    boost::mutex mutex_;
+    boost::condition_variable wake_;
+    std::thread thread_;
+  };
+} // Broker
+
+#endif /* !BROKER_WRITER_HH_ */
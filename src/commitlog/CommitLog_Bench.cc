@@ -14,6 +14,10 @@
 #include <thread>
 #include <fstream>
 #include <chrono>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <algorithm>
 
 namespace
 {
@@ -106,7 +110,7 @@ namespace
               << std::endl;
 
     // partition.close(); in partition destructor,
-    // cost a lot due to syncfs + msync on all index :(.
+    // cost a lot due to munmap + resize on all index :(.
     // Hence, this test is faster to execute than to close.
     // @see Index.cc Index::close() and Index::sync()
 
@@ -132,44 +136,220 @@ namespace
     BOOST_CHECK(countFiles(dir) > 0);
   }
 
-  void testManyWriterAndManyReader(const std::string& suffix, int64_t segment_size)
+  void testManyWriterAndManyReader(const std::string& suffix, int64_t segment_size,
+                                   int64_t nb_writer = 4, int64_t nb_reader = 4)
   {
     const std::string dir = partition_path + suffix;
     CommitLog::Partition partition(dir, segment_size, 0, 0);
     auto res = partition.open();
     BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
 
-    auto start = std::chrono::system_clock::now();
+    if (partition.newestOffset() < static_cast<int64_t>(dico.size()))
+      rangeWrite(partition, 0, dico.size() - 1);
 
     std::vector<std::thread> threads;
-    rangeWrite(partition, 0, dico.size() - 1);
-    for (int i = 0; i < 4; ++i)
+    std::atomic<int64_t> write_elapsed_ms(0);
+    std::atomic<int64_t> read_elapsed_ms(0);
+    auto timed = [](std::atomic<int64_t>& elapsed, std::function<void()> fn) {
+      auto start = std::chrono::system_clock::now();
+      fn();
+      auto end = std::chrono::system_clock::now();
+      const int64_t ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+      int64_t current = elapsed;
+      while (ms > current && !elapsed.compare_exchange_weak(current, ms))
+        ;
+    };
+
+    auto start = std::chrono::system_clock::now();
+    for (int64_t i = 0; i < std::max(nb_writer, nb_reader); ++i)
     {
-      threads.emplace_back(std::thread([&partition]() {
-            rangeWrite(partition, 0, dico.size() - 1);
-          }));
-      threads.emplace_back(std::thread([&partition]() {
-            rangeRead(partition, 0, dico.size() - 1);
-          }));
+      if (i < nb_writer)
+        threads.emplace_back(std::thread([&]() {
+              timed(write_elapsed_ms, [&partition]() {
+                  rangeWrite(partition, 0, dico.size() - 1);
+                });
+            }));
+      if (i < nb_reader)
+        threads.emplace_back(std::thread([&]() {
+              timed(read_elapsed_ms, [&partition]() {
+                  rangeRead(partition, 0, dico.size() - 1);
+                });
+            }));
     }
     for (auto& thread : threads)
       thread.join();
 
     auto end = std::chrono::system_clock::now();
     const int64_t elapsed_ms =
-      std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-
-    std::cout << (5 * dico.size()) << " write in " << elapsed_ms << "ms"
-              << " (" << (5 * dico.size() * 1000 / elapsed_ms) << " msg/s)"
-              << std::endl
-              << (4 * dico.size()) << " read in " << elapsed_ms << "ms"
-              << " (" << (4 * dico.size() * 1000 / elapsed_ms) << " msg/s)"
-              << std::endl
-              << (9 * dico.size()) << " operation in " << elapsed_ms << "ms"
-              << " (" << (9 * dico.size() * 1000 / elapsed_ms) << " msg/s)"
+      std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+    const int64_t nb_write = nb_writer * dico.size();
+    const int64_t nb_read = nb_reader * dico.size();
+
+    std::cout << nb_writer << " writer(s) and " << nb_reader << " reader(s)" << std::endl;
+    if (nb_writer > 0)
+      std::cout << nb_write << " write in " << write_elapsed_ms << "ms"
+                << " (" << (nb_write * 1000 / std::max<int64_t>(1, write_elapsed_ms)) << " msg/s)"
+                << std::endl;
+    if (nb_reader > 0)
+      std::cout << nb_read << " read in " << read_elapsed_ms << "ms"
+                << " (" << (nb_read * 1000 / std::max<int64_t>(1, read_elapsed_ms)) << " msg/s)"
+                << std::endl;
+    std::cout << (nb_write + nb_read) << " operation in " << elapsed_ms << "ms"
+              << " (" << ((nb_write + nb_read) * 1000 / elapsed_ms) << " msg/s)"
               << std::endl;
     BOOST_CHECK(countFiles(dir) > 0);
   }
+
+  int64_t percentile(std::vector<int64_t>& latencies, int64_t percent)
+  {
+    if (latencies.empty())
+      return 0;
+    const int64_t rank = (latencies.size() - 1) * percent / 100;
+    std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+    return latencies[rank];
+  }
+
+  void printLatencies(const std::string& name, std::vector<int64_t>& latencies)
+  {
+    const int64_t max = latencies.empty() ? 0 :
+      *std::max_element(latencies.begin(), latencies.end());
+    std::cout << latencies.size() << " " << name << ": p50 " << percentile(latencies, 50)
+              << "us, p99 " << percentile(latencies, 99) << "us, max " << max << "us"
+              << std::endl;
+  }
+
+  void testRollLatency(const std::string& suffix, int64_t segment_size, int64_t nb_reader)
+  {
+    const std::string dir = partition_path + suffix;
+    CommitLog::Partition partition(dir, segment_size, 0, 0);
+    auto res = partition.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    rangeWrite(partition, 0, 0);
+
+    // A roll only holds the write lock to publish the new segment: the
+    // writer rolling and the readers of the active segment shouldn't
+    // see a spike. The spare segments are prepared as by the broker.
+    std::atomic<bool> stop(false);
+    std::atomic<int64_t> rolls(0); // Odd while a roll is written
+    std::vector<std::thread> threads;
+    threads.emplace_back(std::thread([&]() {
+          while (!stop)
+          {
+            partition.prepareNextSegment();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        }));
+    std::vector<std::vector<int64_t> > read_latencies(nb_reader);
+    std::vector<std::vector<int64_t> > roll_read_latencies(nb_reader);
+    for (int64_t i = 0; i < nb_reader; ++i)
+      threads.emplace_back(std::thread([&, i]() {
+            std::vector<char> payload;
+            while (!stop)
+            {
+              const int64_t offset = partition.newestOffset() - 1;
+              const int64_t rolls_before = rolls;
+              auto start = std::chrono::steady_clock::now();
+              partition.readAt(payload, offset);
+              auto end = std::chrono::steady_clock::now();
+              const int64_t us =
+                std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+              if (rolls_before % 2 || rolls != rolls_before)
+                roll_read_latencies[i].push_back(us);
+              else
+                read_latencies[i].push_back(us);
+            }
+          }));
+
+    std::vector<int64_t> write_latencies;
+    std::vector<int64_t> roll_latencies;
+    for (int64_t i = 1; i < static_cast<int64_t>(dico.size()); ++i)
+    {
+      // Only this thread writes: the active segment can't change meanwhile.
+      const bool roll = partition.activeSegment()->isFull();
+      if (roll)
+        ++rolls;
+      int64_t offset = -1;
+      auto start = std::chrono::steady_clock::now();
+      res = partition.write(dico[i], offset);
+      auto end = std::chrono::steady_clock::now();
+      if (roll)
+        ++rolls;
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      const int64_t us =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+      (roll ? roll_latencies : write_latencies).push_back(us);
+    }
+    stop = true;
+    for (auto& thread : threads)
+      thread.join();
+
+    std::vector<int64_t> all_read_latencies;
+    std::vector<int64_t> all_roll_read_latencies;
+    for (int64_t i = 0; i < nb_reader; ++i)
+    {
+      all_read_latencies.insert(all_read_latencies.end(), read_latencies[i].begin(),
+                                read_latencies[i].end());
+      all_roll_read_latencies.insert(all_roll_read_latencies.end(),
+                                     roll_read_latencies[i].begin(),
+                                     roll_read_latencies[i].end());
+    }
+    printLatencies("write", write_latencies);
+    printLatencies("write with a roll", roll_latencies);
+    printLatencies("read of the newest offset", all_read_latencies);
+    printLatencies("read of the newest offset during a roll", all_roll_read_latencies);
+    BOOST_CHECK(!roll_latencies.empty());
+  }
+
+  void testSegmentLookup(bool direct)
+  {
+    const int64_t segment_size = 4096 * 1024;
+    const std::string dir = partition_path + "/lookup";
+    fs::create_directories(dir);
+    CommitLog::Segment segment(dir, 0, segment_size);
+    segment.deleteSegment();
+    auto res = segment.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+    for (int64_t i = 0; !segment.isFull() && res.code() == mykafka::Error::OK; ++i)
+    {
+      int64_t offset = -1;
+      res = segment.write(dico[i % dico.size()], offset);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    }
+
+    const int64_t nb_lookup = 5000000;
+    std::mt19937_64 generator(42);
+    std::uniform_int_distribution<int64_t> distribution(0, segment.nextOffset() - 1);
+    std::vector<int64_t> offsets(nb_lookup);
+    for (auto& offset : offsets)
+      offset = distribution(generator);
+
+    int64_t rel_offset = -1;
+    int64_t rel_position = -1;
+    int64_t found = 0;
+    auto start = std::chrono::system_clock::now();
+    for (auto offset : offsets)
+    {
+      if (direct)
+        segment.findEntry(rel_offset, rel_position, offset);
+      else
+        segment.searchEntry(rel_offset, rel_position, offset);
+      found += (rel_offset == offset);
+    }
+    auto end = std::chrono::system_clock::now();
+    const int64_t elapsed_us =
+      std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+
+    std::cout << nb_lookup << (direct ? " direct" : " binary search") << " lookup on "
+              << segment.nextOffset() << " entries in " << (elapsed_us / 1000) << "ms"
+              << " (" << (elapsed_us * 1000 / nb_lookup) << " ns/lookup)"
+              << std::endl;
+    BOOST_CHECK_EQUAL(found, nb_lookup);
+
+    segment.close();
+    segment.deleteSegment();
+  }
 } // namespace
 
 BOOST_GLOBAL_FIXTURE(Setup);
@@ -220,3 +400,44 @@ BOOST_FIXTURE_TEST_CASE(bench_commitlog_readwrite_multithread_4M, PrepareTest)
 {
   testManyWriterAndManyReader("/multithread4m", 4096 * 1024); // 4 Mo
 }
+
+// ============================
+
+BOOST_FIXTURE_TEST_CASE(bench_commitlog_read_1_thread_4M, PrepareTest)
+{
+  testManyWriterAndManyReader("/readers4m", 4096 * 1024, 0, 1); // 4 Mo
+}
+
+BOOST_FIXTURE_TEST_CASE(bench_commitlog_read_2_thread_4M, PrepareTest)
+{
+  testManyWriterAndManyReader("/readers4m", 4096 * 1024, 0, 2); // 4 Mo
+}
+
+BOOST_FIXTURE_TEST_CASE(bench_commitlog_read_4_thread_4M, PrepareTest)
+{
+  testManyWriterAndManyReader("/readers4m", 4096 * 1024, 0, 4); // 4 Mo
+}
+
+BOOST_FIXTURE_TEST_CASE(bench_commitlog_read_8_thread_4M, PrepareTest)
+{
+  testManyWriterAndManyReader("/readers4m", 4096 * 1024, 0, 8); // 4 Mo
+}
+
+// ============================
+
+BOOST_FIXTURE_TEST_CASE(bench_commitlog_roll_latency_64K, PrepareTest)
+{
+  testRollLatency("/roll64k", 64 * 1024, 2); // 64 Ko
+}
+
+// ============================
+
+BOOST_FIXTURE_TEST_CASE(bench_segment_lookup_binary_search_4M, PrepareTest)
+{
+  testSegmentLookup(false);
+}
+
+BOOST_FIXTURE_TEST_CASE(bench_segment_lookup_direct_4M, PrepareTest)
+{
+  testSegmentLookup(true);
+}
@@ -6,13 +6,20 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
 namespace CommitLog
 {
+  const int64_t Index::DEFAULT_SIZE;
+  const int64_t Index::MIN_GROW_SIZE;
+  const int64_t Index::MAX_GROW_SIZE;
+  const int64_t Index::ENTRY_WIDTH;
+
   Index::Index(const std::string& filename, int64_t base_offset, int64_t size)
-    : size_(size != 0 ? size : DEFAULT_SIZE), base_offset_(base_offset), position_(0),
+    : capacity_(size != 0 ? size : DEFAULT_SIZE), size_(capacity_), sealed_(false),
+      base_offset_(base_offset), position_(0),
       fd_(-1), addr_(0), filename_(filename)
   {
   }
@@ -46,7 +53,10 @@ namespace CommitLog
     }
 
     position_ = buf.st_size;
-    const int64_t rounded_size = Utils::roundDownToMultiple(size_, ENTRY_WIDTH);
+    sealed_ = false;
+    size_ = std::max(std::max(ENTRY_WIDTH, Utils::roundDownToMultiple(capacity_, ENTRY_WIDTH)),
+                     Utils::roundUpToMultiple(position_, ENTRY_WIDTH));
+    const int64_t rounded_size = size_;
     if (::ftruncate(fd_, rounded_size) < 0)
     {
       if (::close(fd_) < 0)
@@ -89,16 +99,59 @@ namespace CommitLog
     return err;
   }
 
+  mykafka::Error
+  Index::openSealed()
+  {
+    fd_ = ::open(filename_.c_str(), O_RDONLY);
+    if (fd_ < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't open index " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+
+    struct stat buf;
+    if (::fstat(fd_, &buf) < 0)
+    {
+      const std::string error(::strerror(errno));
+      ::close(fd_);
+      fd_ = -1;
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't stat index " +
+                        filename_ + " because: " + error);
+    }
+
+    position_ = buf.st_size;
+    size_ = position_;
+    sealed_ = true;
+    addr_ = 0;
+
+    // Nothing to map for an empty index.
+    if (position_ == 0)
+      return Utils::err(mykafka::Error::OK);
+
+    void* addr = ::mmap(0, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED)
+    {
+      const std::string error(::strerror(errno));
+      ::close(fd_);
+      fd_ = -1;
+      return Utils::err(mykafka::Error::FILE_ERROR, "Error mapping read-only the file " +
+                        filename_ + " because: " + error);
+    }
+    addr_ = addr;
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
   mykafka::Error
   Index::write(int64_t absolute_offset, int64_t position)
   {
     const int32_t rel_offset = absolute_offset - base_offset_;
     const int32_t rel_position = position;
 
-    if (position_ >= size_)
-      return Utils::err(mykafka::Error::INDEX_ERROR, "Write overflow!"
-                        " (" + std::to_string(position_) + " >= " +
-                        std::to_string(size_) + ")");
+    if (position_ + ENTRY_WIDTH > size_)
+    {
+      auto res = grow(ENTRY_WIDTH);
+      if (res.code() != mykafka::Error::OK)
+        return res;
+    }
 
     *reinterpret_cast<int32_t*>(static_cast<char*>(addr_) + position_) = rel_offset;
     position_ += OFFSET_WIDTH;
@@ -108,6 +161,30 @@ namespace CommitLog
     return Utils::err(mykafka::Error::OK);
   }
 
+  mykafka::Error
+  Index::writeBatch(const std::vector<std::pair<int64_t, int64_t> >& entries)
+  {
+    const int64_t needed = entries.size() * ENTRY_WIDTH;
+    if (position_ + needed > size_)
+    {
+      auto res = grow(needed);
+      if (res.code() != mykafka::Error::OK)
+        return res;
+    }
+
+    char* addr = static_cast<char*>(addr_) + position_;
+    for (auto& entry : entries)
+    {
+      *reinterpret_cast<int32_t*>(addr) = entry.first - base_offset_;
+      addr += OFFSET_WIDTH;
+      *reinterpret_cast<int32_t*>(addr) = entry.second;
+      addr += POSITION_WIDTH;
+    }
+    position_ += needed;
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
   mykafka::Error
   Index::read(int64_t& rel_offset, int64_t& rel_position, int64_t relative_offset) const
   {
@@ -122,13 +199,28 @@ namespace CommitLog
     return Utils::err(mykafka::Error::OK);
   }
 
+  bool
+  Index::tryRead(int64_t& rel_offset, int64_t& rel_position, int64_t relative_offset) const
+  {
+    if (relative_offset < 0 || relative_offset > size_ - ENTRY_WIDTH)
+      return false;
+
+    const char* addr = static_cast<const char*>(addr_) + relative_offset;
+    rel_offset = *reinterpret_cast<const int32_t*>(addr) + base_offset_;
+    rel_position = *reinterpret_cast<const int32_t*>(addr + OFFSET_WIDTH);
+    return true;
+  }
+
   mykafka::Error
   Index::sync()
   {
+    if (sealed_ || position_ == 0)
+      return Utils::err(mykafka::Error::OK);
+
     if (msync(addr_, position_, MS_SYNC) < 0)
       return Utils::err(mykafka::Error::FILE_ERROR, "Can't msync " +
                         filename_ + " because: " + std::string(::strerror(errno)));
-    if (syncfs(fd_) < 0)
+    if (::fdatasync(fd_) < 0)
       return Utils::err(mykafka::Error::FILE_ERROR, "Can't file sync " +
                         filename_ + " because: " + std::string(::strerror(errno)));
 
@@ -142,12 +234,13 @@ namespace CommitLog
     if (fd_ < 0)
       return Utils::err(mykafka::Error::OK);
 
-    //    sync(); // FIXME : Cost a lost but could be mandatory.
-    if (munmap(addr_, size_) < 0)
+    // No sync(): the index is checked against the log on open.
+    if (addr_ && munmap(addr_, size_) < 0)
       return Utils::err(mykafka::Error::FILE_ERROR, "Can't unmap index " +
                         filename_ + " because: " + std::string(::strerror(errno)));
 
-    if (ftruncate(fd_, position_) < 0)
+    // A sealed index already has its exact size (and may be read-only).
+    if (!sealed_ && ftruncate(fd_, position_) < 0)
       return Utils::err(mykafka::Error::FILE_ERROR, "Can't resize index " +
                         filename_ + " because: " + std::string(::strerror(errno)));
 
@@ -156,6 +249,62 @@ namespace CommitLog
                         filename_ + " because: " + std::string(::strerror(errno)));
 
     fd_ = -1;
+    addr_ = 0;
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Index::seal()
+  {
+    if (sealed_ || fd_ < 0)
+      return Utils::err(mykafka::Error::OK);
+
+    if (munmap(addr_, size_) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't unmap index " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+    addr_ = 0;
+    size_ = 0;
+    sealed_ = true;
+
+    if (ftruncate(fd_, position_) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't resize index " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+
+    // Nothing to map for an empty index.
+    if (position_ == 0)
+      return Utils::err(mykafka::Error::OK);
+
+    void* addr = ::mmap(0, position_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Error mapping read-only the file " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+    addr_ = addr;
+    size_ = position_;
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Index::grow(int64_t needed)
+  {
+    if (sealed_)
+      return Utils::err(mykafka::Error::INDEX_ERROR, "Write on sealed index " + filename_);
+
+    const int64_t chunk =
+      Utils::roundDownToMultiple(std::min(std::max(size_, MIN_GROW_SIZE), MAX_GROW_SIZE),
+                                 ENTRY_WIDTH);
+    const int64_t new_size = Utils::roundUpToMultiple(position_ + needed, chunk);
+    if (ftruncate(fd_, new_size) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't grow index " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+
+    void* addr = ::mremap(addr_, size_, new_size, MREMAP_MAYMOVE);
+    if (addr == MAP_FAILED)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't remap index " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+    addr_ = addr;
+    size_ = new_size;
+
     return Utils::err(mykafka::Error::OK);
   }
 
@@ -199,18 +348,70 @@ namespace CommitLog
     return filename_;
   }
 
+  mykafka::Error
+  Index::rename(const std::string& filename, int64_t base_offset)
+  {
+    if (::rename(filename_.c_str(), filename.c_str()) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't rename index " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+
+    filename_ = filename;
+    base_offset_ = base_offset;
+    return Utils::err(mykafka::Error::OK);
+  }
+
   int
   Index::fd() const
   {
     return fd_;
   }
 
+  int64_t
+  Index::maxSize() const
+  {
+    return size_;
+  }
+
   int64_t
   Index::baseOffset() const
   {
     return base_offset_;
   }
 
+  int64_t
+  Index::nbEntries() const
+  {
+    return position_ / ENTRY_WIDTH;
+  }
+
+  int64_t
+  Index::nbValidEntries() const
+  {
+    const int64_t nb_entries = std::min(position_, size_) / ENTRY_WIDTH;
+    if (nb_entries == 0)
+      return 0;
+
+    auto isValid = [this](int64_t i) {
+      const int32_t* entry = reinterpret_cast<const int32_t*>
+        (static_cast<const char*>(addr_) + i * ENTRY_WIDTH);
+      const int32_t* previous = entry - ENTRY_WIDTH / sizeof (int32_t);
+      return entry[0] > previous[0] && entry[1] > previous[1];
+    };
+
+    int64_t begin = 1;
+    int64_t end = nb_entries;
+    while (begin < end)
+    {
+      const int64_t pos = (begin + end) / 2;
+      if (isValid(pos))
+        begin = pos + 1;
+      else
+        end = pos;
+    }
+
+    return begin;
+  }
+
   mykafka::Error
   Index::deleteIndex()
   {
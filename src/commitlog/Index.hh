@@ -3,6 +3,7 @@
 
 # include <inttypes.h>
 # include <string>
+# include <vector>
 # include <mutex>
 
 # include "mykafka.pb.h"
@@ -28,6 +29,8 @@ namespace CommitLog
   {
   public:
     static const int64_t DEFAULT_SIZE  = 10 * 1024 * 1024;
+    static const int64_t MIN_GROW_SIZE = 4 * 1024;
+    static const int64_t MAX_GROW_SIZE = 1024 * 1024;
     static const int64_t OFFSET_WIDTH  = 4;
     static const int64_t OFFSET_OFFSET = 0;
     static const int64_t POSITION_WIDTH  = 4;
@@ -39,8 +42,9 @@ namespace CommitLog
     ** Initialize a new index.
     **
     ** @param filename The file name.
-    ** @param bytes The bytes
     ** @param base_offset The base offset.
+    ** @param bytes The initial capacity (0 = DEFAULT_SIZE).
+    **          The index grows when full.
     */
     Index(const std::string& filename, int64_t base_offset, int64_t bytes);
 
@@ -53,12 +57,21 @@ namespace CommitLog
     ** Open existing index or create a new one.
     **
     ** Open a new file (or an existing one).
-    ** Resize it to a defined size before mmap'ing it.
+    ** Resize it to its capacity (or keep it bigger if existing
+    ** data needs it) before mmap'ing it.
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
     mykafka::Error open();
 
+    /*!
+    ** Open an existing sealed index: read-only, mapped at
+    ** its exact size. Used to reopen a released segment.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error openSealed();
+
     /*!
     ** Write a new entry into the index.
     **
@@ -69,6 +82,17 @@ namespace CommitLog
     */
     mykafka::Error write(int64_t absolute_offset, int64_t position);
 
+    /*!
+    ** Write many entries into the index in one pass.
+    ** Capacity is checked once for the whole batch.
+    **
+    ** @param entries Pairs of absolute offset (containing
+    **          base_offset) and position.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error writeBatch(const std::vector<std::pair<int64_t, int64_t> >& entries);
+
     /*!
     ** Read an entry from the index.
     **
@@ -82,7 +106,20 @@ namespace CommitLog
                         int64_t relative_offset) const;
 
     /*!
-    ** Force a file sync.
+    ** Read an entry from the index, without building any error.
+    ** Meant for hot lookup loops.
+    **
+    ** @param rel_offset The offset to get.
+    ** @param rel_position The position to get.
+    ** @param relative_offset The offset (not containing base_offset).
+    **
+    ** @return False if the read overflows the index.
+    */
+    bool tryRead(int64_t& rel_offset, int64_t& rel_position,
+                 int64_t relative_offset) const;
+
+    /*!
+    ** Force a sync of this index file only (msync + fdatasync).
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
@@ -95,6 +132,14 @@ namespace CommitLog
     */
     mykafka::Error close();
 
+    /*!
+    ** Seal the index: no more writes are allowed. The file is
+    ** shrunk to its exact size, and mapped read-only.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error seal();
+
     /*!
     ** Check if index is corrupted.
     **
@@ -109,6 +154,17 @@ namespace CommitLog
     */
     std::string filename() const;
 
+    /*!
+    ** Rename the index file, and change its base offset.
+    ** @warning The index must be empty.
+    **
+    ** @param filename The new file name.
+    ** @param base_offset The new base offset.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error rename(const std::string& filename, int64_t base_offset);
+
     /*!
     ** Truncate at number of entries.
     **
@@ -139,6 +195,23 @@ namespace CommitLog
     */
     int64_t baseOffset() const;
 
+    /*!
+    ** Get the number of entries written.
+    **
+    ** @return The number of entries.
+    */
+    int64_t nbEntries() const;
+
+    /*!
+    ** Get the number of valid entries, from the start of the index.
+    ** Offsets and positions are strictly increasing, so the first
+    ** entry which isn't (like zeroes left by a crash) is found with
+    ** a binary search.
+    **
+    ** @return The number of valid entries.
+    */
+    int64_t nbValidEntries() const;
+
     /*!
     ** Physically remove index file.
     **
@@ -147,14 +220,27 @@ namespace CommitLog
     mykafka::Error deleteIndex();
 
   private:
-    const int64_t size_;
-    const int64_t base_offset_;
+    /*!
+    ** Grow the mapping (and the file) by chunks, so that
+    ** needed more bytes can be written.
+    **
+    ** @param needed The number of bytes to write.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error grow(int64_t needed);
+
+  private:
+    const int64_t capacity_;
+    int64_t size_;
+    bool sealed_;
+    int64_t base_offset_;
   public:
     int64_t position_;
   private:
     int fd_;
     void* addr_;
-    const std::string filename_;
+    std::string filename_;
   };
 } // CommitLog
 
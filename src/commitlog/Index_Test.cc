@@ -107,3 +107,66 @@ BOOST_AUTO_TEST_CASE(test_index_big_offset)
 {
   testIndex(420077);
 }
+
+BOOST_AUTO_TEST_CASE(test_index_grow_and_seal)
+{
+  const std::string tmp_file = "/tmp/mykafka-test/test-grow.index";
+  const int64_t base_offset = 1000;
+  const int64_t total_entries = 1000;
+  CommitLog::Index index(tmp_file, base_offset, 2 * CommitLog::Index::ENTRY_WIDTH);
+  index.deleteIndex();
+
+  auto res = index.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(index.maxSize(), 2 * CommitLog::Index::ENTRY_WIDTH);
+
+  for (int64_t i = 0; i < total_entries; ++i)
+  {
+    res = index.write(base_offset + i, i * 10);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+  BOOST_CHECK(index.maxSize() >= total_entries * CommitLog::Index::ENTRY_WIDTH);
+
+  std::vector<std::pair<int64_t, int64_t> > batch;
+  for (int64_t i = total_entries; i < 2 * total_entries; ++i)
+    batch.push_back(std::make_pair(base_offset + i, i * 10));
+  res = index.writeBatch(batch);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  auto checkEntries = [&index, base_offset](int64_t nb) {
+    int64_t offset = -1;
+    int64_t position = -1;
+    for (int64_t i = 0; i < nb; ++i)
+    {
+      auto res = index.read(offset, position, i * CommitLog::Index::ENTRY_WIDTH);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      BOOST_CHECK_EQUAL(offset, base_offset + i);
+      BOOST_CHECK_EQUAL(position, i * 10);
+    }
+  };
+  checkEntries(2 * total_entries);
+
+  // Sealed: exact size, read-only.
+  res = index.seal();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  struct stat buf;
+  fstat(index.fd(), &buf);
+  BOOST_CHECK_EQUAL(buf.st_size, 2 * total_entries * CommitLog::Index::ENTRY_WIDTH);
+  BOOST_CHECK_EQUAL(index.maxSize(), buf.st_size);
+  checkEntries(2 * total_entries);
+  res = index.write(base_offset + 2 * total_entries, 0);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::INDEX_ERROR, res.msg());
+
+  // Reopen keeps all entries, even above the initial capacity.
+  res = index.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  res = index.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(index.nbEntries(), 2 * total_entries);
+  checkEntries(2 * total_entries);
+  res = index.write(base_offset + 2 * total_entries, 0);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  res = index.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
@@ -3,7 +3,12 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/range/iterator_range.hpp>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
 
 namespace CommitLog
 {
@@ -32,13 +37,28 @@ namespace CommitLog
       }
       std::sort(offset_list.begin(), offset_list.end());
     }
+
+    int64_t nowMs()
+    {
+      return std::chrono::duration_cast<std::chrono::milliseconds>
+        (std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
   } // namespace
 
   Partition::Partition(const std::string& path, int64_t max_segment_size,
-                       int64_t max_partition_size, int64_t segment_ttl)
+                       int64_t max_partition_size, int64_t segment_ttl,
+                       int64_t index_interval_bytes,
+                       const std::shared_ptr<SegmentCache>& segment_cache,
+                       int64_t flush_messages, int64_t flush_ms)
     : cancel_(false), max_segment_size_(max_segment_size),
       max_partition_size_(max_partition_size), segment_ttl_(segment_ttl),
-      physical_size_(0), active_segment_(0), path_(path), name_(), segments_()
+      index_interval_bytes_(index_interval_bytes), physical_size_(0), truncated_bytes_(0),
+      flush_messages_(flush_messages), flush_ms_(flush_ms), written_offset_(0),
+      flushed_offset_(0), last_flush_ms_(nowMs()), failed_from_(0), failed_to_(0),
+      flush_error_(Utils::err(mykafka::Error::OK)), commit_offset_(-1),
+      active_segment_(0), path_(path), name_(),
+      segments_(std::make_shared<const segments_type>()),
+      segment_cache_(segment_cache), spare_segment_(0), spare_enabled_(false)
   {
   }
 
@@ -48,7 +68,7 @@ namespace CommitLog
   }
 
   mykafka::Error
-  Partition::open()
+  Partition::open(const RecoveryPoint& recovery_point, int32_t nb_threads)
   {
     fs::path raw_path(path_);
     try
@@ -60,39 +80,72 @@ namespace CommitLog
       fs::create_directories(raw_path);
       std::vector<int64_t> offset_list;
       fillFilesList(raw_path, offset_list);
+      const bool use_recovery_point =
+        std::binary_search(offset_list.begin(), offset_list.end(), recovery_point.base_offset);
+      const int64_t nb_segments = offset_list.size();
+      auto segments = std::make_shared<segments_type>();
       for (auto base_offset : offset_list)
+        segments->push_back(std::make_shared<Segment>(path_, base_offset, max_segment_size_,
+                                                      index_interval_bytes_,
+                                                      segment_cache_.get()));
+
+      // Segments are independent: open them (and seal all but the last) in parallel.
+      std::vector<mykafka::Error> results(nb_segments);
+      Utils::parallelFor(nb_segments, nb_threads, [&](int64_t i)
+                         {
+                           const int64_t base_offset = offset_list[i];
+                           int64_t recovery_offset = -1;
+                           int64_t recovery_position = -1;
+                           if (use_recovery_point && base_offset < recovery_point.base_offset)
+                             recovery_offset = offset_list[i + 1]; // Sealed before the checkpoint
+                           else if (use_recovery_point &&
+                                    base_offset == recovery_point.base_offset)
+                           {
+                             recovery_offset = recovery_point.next_offset;
+                             recovery_position = recovery_point.size;
+                           }
+
+                           results[i] = (*segments)[i]->open(recovery_offset,
+                                                             recovery_position);
+                           if (results[i].code() == mykafka::Error::OK && i + 1 < nb_segments)
+                             results[i] = (*segments)[i]->seal();
+                         });
+
+      for (int64_t i = 0; i < nb_segments; ++i)
       {
-        Segment* segment = new Segment(path_, base_offset, max_segment_size_);
-        auto res = segment->open();
-        if (res.code() != mykafka::Error::OK)
-        {
-          delete segment;
-          return res;
-        }
-        physical_size_ += segment->size();
-        segments_.push_back(segment);
+        if (results[i].code() != mykafka::Error::OK)
+          return results[i];
+        physical_size_ += (*segments)[i]->size();
+        truncated_bytes_ += (*segments)[i]->truncatedBytes();
       }
 
-      if (segments_.empty())
+      if (segments->empty())
       {
-        Segment* segment = new Segment(path_, 0, max_segment_size_);
+        auto segment = std::make_shared<Segment>(path_, 0, max_segment_size_,
+                                                 index_interval_bytes_, segment_cache_.get());
         auto res = segment->open();
         if (res.code() != mykafka::Error::OK)
-        {
-          delete segment;
           return res;
-        }
-        segments_.push_back(segment);
+        segments->push_back(segment);
       }
 
-      active_segment_ = segments_.back();
+      boost::lock_guard<boost::shared_mutex> lock(mutex_);
+      active_segment_ = segments->back().get();
+      commit_offset_ = segments->back()->nextOffset() - 1;
+      written_offset_ = segments->back()->nextOffset();
+      flushed_offset_ = written_offset_.load();
+      publish(segments);
     }
     catch (fs::filesystem_error& e)
     {
       return Utils::err(mykafka::Error::INVALID_FILENAME, e.what());
     }
 
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
+    {
+      boost::lock_guard<boost::mutex> spare_lock(spare_mutex_);
+      spare_enabled_ = true;
+    }
+
     cleanOldSegments();
     return Utils::err(mykafka::Error::OK);
   }
@@ -100,56 +153,358 @@ namespace CommitLog
   mykafka::Error
   Partition::write(const std::vector<char>& payload, int64_t& offset)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
-    if (cancel_)
-      return Utils::err(mykafka::Error::PARTITION_ERROR, "Partition is closed");
+    {
+      boost::lock_guard<boost::mutex> append_lock(append_mutex_);
+      if (cancel_)
+        return Utils::err(mykafka::Error::PARTITION_ERROR, "Partition is closed");
 
-    assert(active_segment_);
-    if ((*active_segment_).isFull())
+      auto res = rollIfNeeded();
+      if (res.code() != mykafka::Error::OK)
+        return res;
+
+      boost::lock_guard<boost::shared_mutex> lock(mutex_);
+      res = (*active_segment_).write(payload, offset);
+      if (res.code() != mykafka::Error::OK)
+        return res;
+
+      physical_size_ += payload.size() + Segment::HEADER_SIZE;
+      written_offset_ = offset + 1;
+    }
+
+    // Flushed without the write lock: readers go on meanwhile.
+    if (flush_messages_ > 0 && offset + 1 - flushed_offset_ >= flush_messages_)
+      return waitFlushed(offset, offset + 1);
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Partition::writeBatch(const std::vector<std::vector<char> >& payloads,
+                        int64_t& first_offset)
+  {
     {
-      Segment* segment = new Segment(path_, (*active_segment_).nextOffset(),
-                                     max_segment_size_);
-      auto res = segment->open();
+      boost::lock_guard<boost::mutex> append_lock(append_mutex_);
+      if (cancel_)
+        return Utils::err(mykafka::Error::PARTITION_ERROR, "Partition is closed");
+
+      auto res = rollIfNeeded();
+      if (res.code() != mykafka::Error::OK)
+        return res;
+
+      boost::lock_guard<boost::shared_mutex> lock(mutex_);
+      const int64_t previous_size = (*active_segment_).size();
+      res = (*active_segment_).writeBatch(payloads, first_offset);
       if (res.code() != mykafka::Error::OK)
+        return res;
+
+      physical_size_ += (*active_segment_).size() - previous_size;
+      written_offset_ = first_offset + payloads.size();
+    }
+
+    // Flushed without the write lock: readers go on meanwhile.
+    const int64_t next_offset = first_offset + payloads.size();
+    if (flush_messages_ > 0 && next_offset - flushed_offset_ >= flush_messages_)
+      return waitFlushed(first_offset, next_offset);
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Partition::flush()
+  {
+    // One flush at a time: a flush waits for the one syncing the
+    // messages it would have taken.
+    boost::lock_guard<boost::mutex> flush_lock(flush_mutex_);
+    return flushLocked();
+  }
+
+  mykafka::Error
+  Partition::flushLocked()
+  {
+    int64_t next_offset = -1;
+    int fd = -1;
+    segments_type rolled;
+    {
+      boost::shared_lock<boost::shared_mutex> lock(mutex_);
+      if (cancel_ || !active_segment_)
+        return Utils::err(mykafka::Error::OK); // Flushed on close
+
+      next_offset = (*active_segment_).nextOffset();
+      if (next_offset <= flushed_offset_)
+        return Utils::err(mykafka::Error::OK);
+
+      // The segments rolled since the last flush aren't synced yet.
+      auto segments = segmentsSnapshot();
+      for (auto segment = segments->rbegin() + 1;
+           segment < segments->rend() && (*segment)->nextOffset() > flushed_offset_;
+           ++segment)
+        rolled.push_back(*segment);
+
+      // Synced out of the lock, on its own descriptor: a roll can
+      // seal (and close) the segment meanwhile.
+      fd = ::dup((*active_segment_).segmentFd());
+      if (fd < 0)
+        return Utils::err(mykafka::Error::FILE_ERROR,
+                          "Can't flush partition " + path_ + " because: " +
+                          std::string(::strerror(errno)));
+    }
+
+    last_flush_ms_ = nowMs();
+    auto res = Utils::err(mykafka::Error::OK);
+    for (auto& segment : rolled)
+      if (res.code() == mykafka::Error::OK)
+        res = segment->syncLog();
+    if (res.code() == mykafka::Error::OK && ::fdatasync(fd) < 0)
+      res = Utils::err(mykafka::Error::FILE_ERROR,
+                       "Can't flush partition " + path_ + " because: " +
+                       std::string(::strerror(errno)));
+    if (res.code() != mykafka::Error::OK)
+    {
+      // Their pages may be lost, even if a later sync succeeds.
+      failed_from_ = flushed_offset_;
+      failed_to_ = next_offset;
+      flush_error_ = res;
+    }
+    else
+      advanceFlushedOffset(next_offset);
+    ::close(fd);
+    return res;
+  }
+
+  mykafka::Error
+  Partition::waitFlushed(int64_t first_offset, int64_t next_offset)
+  {
+    // Waits for a flush in progress, which may sync these messages.
+    boost::lock_guard<boost::mutex> flush_lock(flush_mutex_);
+    if (first_offset < failed_to_ && next_offset > failed_from_)
+      return flush_error_;
+    if (next_offset <= flushed_offset_)
+      return Utils::err(mykafka::Error::OK);
+
+    return flushLocked();
+  }
+
+  void
+  Partition::advanceFlushedOffset(int64_t next_offset)
+  {
+    int64_t current = flushed_offset_;
+    while (next_offset > current && !flushed_offset_.compare_exchange_weak(current, next_offset))
+      ;
+  }
+
+  mykafka::Error
+  Partition::flushIfDue()
+  {
+    if (flush_ms_ <= 0 || written_offset_ <= flushed_offset_ ||
+        nowMs() - last_flush_ms_ < flush_ms_)
+      return Utils::err(mykafka::Error::OK);
+
+    return flush();
+  }
+
+  int64_t
+  Partition::unflushedMessages() const
+  {
+    return written_offset_ - flushed_offset_;
+  }
+
+  int64_t
+  Partition::flushedOffset() const
+  {
+    return flushed_offset_;
+  }
+
+  mykafka::Error
+  Partition::rollIfNeeded()
+  {
+    assert(active_segment_);
+    if (!(*active_segment_).isFull())
+      return Utils::err(mykafka::Error::OK);
+
+    // Not visible until published: opened (or renamed) out of the lock.
+    Segment* segment = 0;
+    bool from_spare = false;
+    auto res = openNextSegment(segment, from_spare);
+    if (res.code() != mykafka::Error::OK)
+      return res;
+
+    std::shared_ptr<Segment> rolled;
+    {
+      boost::lock_guard<boost::shared_mutex> lock(mutex_);
+      auto segments = std::make_shared<segments_type>(*segmentsSnapshot());
+      rolled = segments->back();
+      segments->emplace_back(segment);
+      active_segment_ = segment;
+      publish(segments);
+    }
+
+    // Sealed out of the lock, readers pin it meanwhile. Not synced
+    // either (see flush): a checkpoint flushes before it's saved.
+    if (!from_spare)
+      return rolled->seal();
+
+    // Its spare came from a background preparer, which seals it too.
+    boost::lock_guard<boost::mutex> rolled_lock(rolled_mutex_);
+    rolled_segments_.push_back(rolled);
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Partition::openNextSegment(Segment*& segment, bool& from_spare)
+  {
+    const int64_t base_offset = (*active_segment_).nextOffset();
+    segment = 0;
+    from_spare = false;
+    {
+      // Never wait for a spare segment being prepared. Renamed under the
+      // lock: the next spare segment is created under the same names.
+      boost::unique_lock<boost::mutex> spare_lock(spare_mutex_, boost::try_to_lock);
+      if (spare_lock.owns_lock() && spare_segment_)
       {
+        std::swap(segment, spare_segment_);
+        auto res = segment->assignBaseOffset(base_offset);
+        if (res.code() == mykafka::Error::OK)
+        {
+          from_spare = true;
+          return res;
+        }
+        segment->deleteSegment();
         delete segment;
-        return res;
+        segment = 0;
       }
-      segments_.push_back(segment);
-      active_segment_ = segments_.back();
-      if (segment_ttl_ != 0 || max_partition_size_ != 0)
-        cleanOldSegments(); // /!\ If segments are small, could destroy performance...
     }
 
-    auto res = (*active_segment_).write(payload, offset);
+    segment = new Segment(path_, base_offset, max_segment_size_, index_interval_bytes_,
+                          segment_cache_.get());
+    auto res = segment->open();
+    if (res.code() != mykafka::Error::OK)
+    {
+      delete segment;
+      segment = 0;
+    }
+
+    return res;
+  }
+
+  mykafka::Error
+  Partition::prepareNextSegment()
+  {
+    segments_type rolled;
+    {
+      boost::lock_guard<boost::mutex> rolled_lock(rolled_mutex_);
+      rolled.swap(rolled_segments_);
+    }
+    auto res = Utils::err(mykafka::Error::OK);
+    for (auto& segment : rolled)
+    {
+      auto local_res = segment->seal();
+      if (local_res.code() != mykafka::Error::OK)
+        res = local_res;
+    }
+
+    boost::lock_guard<boost::mutex> spare_lock(spare_mutex_);
+    if (!spare_enabled_ || spare_segment_)
+      return res;
+
+    Segment* segment = new Segment(path_, Segment::SPARE_BASE_OFFSET, max_segment_size_,
+                                   index_interval_bytes_, segment_cache_.get());
+    auto local_res = segment->open();
+    if (local_res.code() != mykafka::Error::OK)
+    {
+      delete segment;
+      return local_res;
+    }
+    spare_segment_ = segment;
+
+    return res;
+  }
+
+  template <typename T>
+  mykafka::Error
+  Partition::readPayload(T& payload, int64_t offset)
+  {
+    auto segments = segmentsSnapshot();
+    if (segments->empty())
+      return Utils::err(mykafka::Error::PARTITION_ERROR, "Partition is closed");
+
+    std::shared_ptr<Segment> found_segment;
+    auto res = findSegment(found_segment, *segments, offset);
     if (res.code() != mykafka::Error::OK)
       return res;
+    if (!found_segment)
+      return Utils::err(mykafka::Error::PARTITION_ERROR, "Can't find "
+                        "segment for offset " + std::to_string(offset));
 
-    physical_size_ += payload.size() + Segment::HEADER_SIZE;
+    // Only the last segment of a snapshot may still be written.
+    boost::shared_lock<boost::shared_mutex> lock(mutex_, boost::defer_lock);
+    if (found_segment == segments->back())
+      lock.lock();
+    res = found_segment->pin();
+    if (res.code() != mykafka::Error::OK)
+      return res;
+    res = found_segment->readAt(payload, offset - found_segment->baseOffset());
+    found_segment->unpin();
 
-    return Utils::err(mykafka::Error::OK);
+    return res;
   }
 
   mykafka::Error
   Partition::readAt(std::vector<char>& payload, int64_t offset)
   {
-    boost::lock_guard<boost::shared_mutex> lock(mutex_);
-    if (cancel_)
+    return readPayload(payload, offset);
+  }
+
+  mykafka::Error
+  Partition::readAt(std::string& payload, int64_t offset)
+  {
+    return readPayload(payload, offset);
+  }
+
+  mykafka::Error
+  Partition::readRange(std::shared_ptr<const char>& data,
+                       std::vector<Segment::Record>& records,
+                       int64_t offset, int64_t max_bytes, int64_t max_messages)
+  {
+    data.reset();
+    records.clear();
+    auto segments = segmentsSnapshot();
+    if (segments->empty())
       return Utils::err(mykafka::Error::PARTITION_ERROR, "Partition is closed");
 
-    Segment* found_segment = 0;
-    auto res = findSegment(found_segment, offset);
+    std::shared_ptr<Segment> found_segment;
+    auto res = findSegment(found_segment, *segments, offset);
     if (res.code() != mykafka::Error::OK)
       return res;
     if (!found_segment)
       return Utils::err(mykafka::Error::PARTITION_ERROR, "Can't find "
                         "segment for offset " + std::to_string(offset));
 
-    res = found_segment->readAt(payload, offset - found_segment->baseOffset());
+    // Only the last segment of a snapshot may still be written.
+    boost::shared_lock<boost::shared_mutex> lock(mutex_, boost::defer_lock);
+    if (found_segment == segments->back())
+      lock.lock();
+    res = found_segment->pin();
     if (res.code() != mykafka::Error::OK)
       return res;
+    auto buffer = std::make_shared<std::vector<char> >();
+    const char* raw = 0;
+    res = found_segment->readRange(*buffer, raw, records,
+                                   offset - found_segment->baseOffset(),
+                                   max_bytes, max_messages);
+    if (res.code() != mykafka::Error::OK || !found_segment->isMapped())
+    {
+      found_segment->unpin();
+      if (res.code() == mykafka::Error::OK)
+        data = std::shared_ptr<const char>(buffer, raw);
+      return res;
+    }
 
-    return Utils::err(mykafka::Error::OK);
+    // The mapping stays valid until data is released.
+    data = std::shared_ptr<const char>(raw, [found_segment](const char*) {
+        found_segment->unpin();
+      });
+
+    return res;
   }
 
   int64_t
@@ -163,14 +518,26 @@ namespace CommitLog
     return (*active_segment_).nextOffset();
   }
 
+  int64_t
+  Partition::commitOffset() const
+  {
+    return commit_offset_;
+  }
+
+  void
+  Partition::setCommitOffset(int64_t offset)
+  {
+    commit_offset_ = offset;
+  }
+
   int64_t
   Partition::oldestOffset() const
   {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-    if (cancel_)
+    auto segments = segmentsSnapshot();
+    if (segments->empty())
       return -1;
 
-    return segments_.front()->baseOffset();
+    return segments->front()->baseOffset();
   }
 
   Segment*
@@ -180,6 +547,29 @@ namespace CommitLog
     return active_segment_;
   }
 
+  int64_t
+  Partition::nbSegments() const
+  {
+    return segmentsSnapshot()->size();
+  }
+
+  int64_t
+  Partition::truncatedBytes() const
+  {
+    return truncated_bytes_;
+  }
+
+  Partition::RecoveryPoint
+  Partition::recoveryPoint() const
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    const Segment* segment = active_segment_;
+    if (!segment)
+      return RecoveryPoint{-1, -1, -1};
+    return RecoveryPoint{segment->baseOffset(), segment->nextOffset(), segment->size()};
+  }
+
   int64_t
   Partition::physicalSize() const
   {
@@ -190,19 +580,39 @@ namespace CommitLog
   mykafka::Error
   Partition::close()
   {
+    if (flush_messages_ > 0 || flush_ms_ > 0)
+    {
+      auto res = flush();
+      if (res.code() != mykafka::Error::OK)
+        return res;
+    }
+
+    boost::lock_guard<boost::mutex> append_lock(append_mutex_);
     boost::lock_guard<boost::shared_mutex> lock(mutex_);
 
+    {
+      boost::lock_guard<boost::mutex> rolled_lock(rolled_mutex_);
+      rolled_segments_.clear();
+    }
+    {
+      boost::lock_guard<boost::mutex> spare_lock(spare_mutex_);
+      spare_enabled_ = false;
+      if (spare_segment_)
+      {
+        auto res = spare_segment_->deleteSegment();
+        delete spare_segment_;
+        spare_segment_ = 0;
+        if (res.code() != mykafka::Error::OK)
+          return res;
+      }
+    }
+
     cancel_ = true;
     active_segment_ = 0;
     physical_size_ = 0;
-    for (auto segment : segments_)
-    {
-      auto res = segment->close();
-      if (res.code() != mykafka::Error::OK)
-        return res;
-      delete segment;
-    }
-    segments_.clear();
+    // Each segment is closed by the last one dropping it: here,
+    // or a reader still holding it.
+    publish(std::make_shared<segments_type>());
 
     return Utils::err(mykafka::Error::OK);
   }
@@ -220,16 +630,45 @@ namespace CommitLog
   }
 
   mykafka::Error
-  Partition::cleanOldSegments()
+  Partition::cleanOldSegments(int64_t max_bytes_per_sec)
+  {
+    if (segment_ttl_ == 0 && max_partition_size_ == 0)
+      return Utils::err(mykafka::Error::OK);
+
+    segments_type expired;
+    {
+      boost::lock_guard<boost::shared_mutex> lock(mutex_);
+      if (cancel_)
+        return Utils::err(mykafka::Error::OK);
+      detachOldSegments(expired);
+    }
+
+    // Not in the list anymore: only the readers already holding a
+    // segment can still use it, the last one deletes it (usually here).
+    for (auto& segment : expired)
+    {
+      const int64_t size = segment->size();
+      segment->deleteOnDestroy();
+      segment.reset();
+      if (max_bytes_per_sec > 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(size * 1000000 /
+                                                              max_bytes_per_sec));
+    }
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  void
+  Partition::detachOldSegments(segments_type& expired)
   {
-    auto res = Utils::err(mykafka::Error::OK);
     const int64_t now = ::time(0);
     const int64_t seg_ttl = segment_ttl_;
     const int64_t max_size = max_partition_size_;
-    segments_.erase(std::remove_if(segments_.begin(), segments_.end(),
-                                   [&](Segment* segment)
+    auto segments = std::make_shared<segments_type>(*segmentsSnapshot());
+    segments->erase(std::remove_if(segments->begin(), segments->end(),
+                                   [&](const std::shared_ptr<Segment>& segment)
                                    {
-                                     if (segment == active_segment_)
+                                     if (segment.get() == active_segment_)
                                        return false;
 
                                      const int64_t size = segment->size();
@@ -239,42 +678,49 @@ namespace CommitLog
                                        physical_size_ > max_size;
                                      if (too_old || partition_too_large)
                                      {
-                                       auto local_res = segment->deleteSegment();
-                                       if (local_res.code() != mykafka::Error::OK)
-                                       {
-                                         res = local_res;
-                                         return false;
-                                       }
-                                       delete segment;
+                                       expired.push_back(segment);
                                        physical_size_ -= size;
                                        return true;
                                      }
                                      return false;
-                                   }), segments_.end());
+                                   }), segments->end());
+    if (!expired.empty())
+      publish(segments);
+  }
 
-    return res;
+  std::shared_ptr<const Partition::segments_type>
+  Partition::segmentsSnapshot() const
+  {
+    return std::atomic_load(&segments_);
+  }
+
+  void
+  Partition::publish(const std::shared_ptr<const segments_type>& segments)
+  {
+    std::atomic_store(&segments_, segments);
   }
 
   mykafka::Error
-  Partition::findSegment(Segment*& found_segment, int64_t search_offset)
+  Partition::findSegment(std::shared_ptr<Segment>& found_segment,
+                         const segments_type& segments, int64_t search_offset) const
   {
-    found_segment = 0;
-    if (segments_.empty())
+    found_segment = nullptr;
+    if (segments.empty())
       return Utils::err(mykafka::Error::OK);
 
     int64_t begin = 0;
-    int64_t end = segments_.size() - 1;
+    int64_t end = segments.size() - 1;
     int64_t pos = (begin + end) / 2;
     int64_t found_offset = -1;
 
     while (begin <= end && found_offset != search_offset)
     {
-      found_offset = segments_[pos]->baseOffset();
+      found_offset = segments[pos]->baseOffset();
       if (found_offset > search_offset)
         end = pos - 1;
       else
       {
-        found_segment = segments_[pos];
+        found_segment = segments[pos];
         begin = pos + 1;
       }
       pos = (begin + end) / 2;
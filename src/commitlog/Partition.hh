@@ -4,9 +4,11 @@
 # include "commitlog/Segment.hh"
 # include "mykafka.pb.h"
 
+# include <boost/thread/mutex.hpp>
 # include <boost/thread/shared_mutex.hpp>
 # include <vector>
 # include <atomic>
+# include <memory>
 
 namespace CommitLog
 {
@@ -30,6 +32,16 @@ namespace CommitLog
   **   |_______ 00000000000000000837.log
   ** @endverbatim
   **
+  ** The segment list is an immutable snapshot of reference counted
+  ** segments: readers load it without any lock, rolls and retention
+  ** publish a modified copy. A segment is closed (or deleted) once
+  ** the last snapshot or reader using it is gone.
+  **
+  ** Writers are serialized by their own lock, and only take the
+  ** write lock (which readers of the active segment share) to
+  ** append, or to publish a roll: the next segment is opened before,
+  ** the old one is sealed after.
+  **
   ** Simple example:
   ** @code
   **   const std::string msg = "Hello world";
@@ -44,6 +56,21 @@ namespace CommitLog
   */
   class Partition
   {
+  public:
+    /*!
+    ** @struct RecoveryPoint
+    **
+    ** State of the active segment, saved in a checkpoint.
+    ** Segments before it are sealed and fully trusted on open,
+    ** its own log is trusted up to size.
+    */
+    struct RecoveryPoint
+    {
+      int64_t base_offset;
+      int64_t next_offset;
+      int64_t size;
+    };
+
   public:
     /*!
     ** Initialize a new partition.
@@ -54,9 +81,21 @@ namespace CommitLog
     **          partition (0 = no size restriction).
     ** @param segment_ttl Time after a segment has to
     **          be destroyed in seconds (0 = disabled).
+    ** @param index_interval_bytes Write an index entry every N
+    **          bytes of log (0 = one entry per message).
+    ** @param segment_cache Cache limiting the sealed segments with
+    **          open files (null = sealed segments stay open).
+    ** @param flush_messages Flush the log once N messages are written:
+    **          the write returns once its messages are on the disk
+    **          (0 = disabled, 1 = every write).
+    ** @param flush_ms Flush the log every N ms, see flushIfDue
+    **          (0 = disabled).
     */
     Partition(const std::string& path, int64_t max_segment_size,
-              int64_t max_partition_size, int64_t segment_ttl);
+              int64_t max_partition_size, int64_t segment_ttl,
+              int64_t index_interval_bytes = 0,
+              const std::shared_ptr<SegmentCache>& segment_cache = nullptr,
+              int64_t flush_messages = 0, int64_t flush_ms = 0);
 
     /*!
     ** Close all files own and free segments.
@@ -68,13 +107,21 @@ namespace CommitLog
     ** Create all directories needed. Reload existing segments
     ** and create new one if necessary.
     **
+    ** Segments are opened by a pool of nb_threads threads.
+    **
+    ** @param recovery_point Where to start the recovery from
+    **          (base_offset = -1 means check every segment).
+    ** @param nb_threads The max number of threads opening
+    **          segments (0 = nb machine core).
+    **
     ** @return Error code 0 if no error, or a detailed error.
     */
-    mykafka::Error open();
+    mykafka::Error open(const RecoveryPoint& recovery_point = RecoveryPoint{-1, -1, -1},
+                        int32_t nb_threads = 1);
 
     /*!
     ** Write payload into the right segments.
-    ** If a new segment is created, also clean old segments.
+    ** Flushed before returning, if flush_messages is reached.
     **
     ** @param payload Data to write.
     ** @param offset Where the data has been written.
@@ -83,8 +130,27 @@ namespace CommitLog
     */
     mykafka::Error write(const std::vector<char>& payload, int64_t& offset);
 
+    /*!
+    ** Write all payloads into the active segment, under a single lock.
+    ** Offsets are contiguous. A batch is never split across segments,
+    ** so a segment can exceed its max size by (at most) one batch.
+    ** Flushed before returning, if flush_messages is reached.
+    **
+    ** @param payloads Data to write.
+    ** @param first_offset Where the first payload has been written.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error writeBatch(const std::vector<std::vector<char> >& payloads,
+                              int64_t& first_offset);
+
     /*!
     ** Find the right segment, and then read data from it, at the right position.
+    ** The segment is found in a snapshot of the segment list, without
+    ** any lock: sealed segments are read lock-free (from their mapping),
+    ** only the active one shares the partition lock with the writer.
+    ** A segment removed meanwhile stays valid until read.
+    ** The string version allows reading directly into a protobuf field.
     **
     ** @param payload Data to write.
     ** @param offset Where the data has been written.
@@ -92,6 +158,89 @@ namespace CommitLog
     ** @return Error code 0 if no error, or a detailed error.
     */
     mykafka::Error readAt(std::vector<char>& payload, int64_t offset);
+    mykafka::Error readAt(std::string& payload, int64_t offset);
+
+    /*!
+    ** Find the right segment, and then read contiguous records from it.
+    ** A range never spans two segments. See Segment::readRange for the
+    ** limits.
+    ** A sealed segment is not copied: data points into its mapping, and
+    ** keeps the segment pinned (and alive) until released. The active
+    ** segment is read with a single positional read into a buffer owned
+    ** by data. Either way, a payload is at data.get() + record.position.
+    **
+    ** @param data The raw read bytes.
+    ** @param records The records found in data.
+    ** @param offset The first offset to read.
+    ** @param max_bytes The max number of bytes to read.
+    ** @param max_messages The max number of records to read.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error readRange(std::shared_ptr<const char>& data,
+                             std::vector<Segment::Record>& records,
+                             int64_t offset, int64_t max_bytes, int64_t max_messages);
+
+    /*!
+    ** Flush the log of the active segment, if something
+    ** was written since the last flush, and of the segments
+    ** rolled since (a roll doesn't sync). Neither readers nor the
+    ** writer are blocked during the sync. Returns once everything
+    ** written before the call is on the disk: the flushed offset
+    ** is only advanced by a successful sync.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error flush();
+
+    /*!
+    ** Flush, if flush_ms is set and elapsed since the last flush.
+    ** Meant to be called periodically by a background flusher.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error flushIfDue();
+
+    /*!
+    ** Open the next segment ahead (as a spare segment), if it isn't
+    ** already, so the next roll only has to rename its files. The
+    ** segments rolled onto the previous spare are sealed first. Doesn't
+    ** block writers nor readers. Meant to be called periodically
+    ** by a background thread: a roll without a spare segment
+    ** ready creates it (and seals the old one) itself.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error prepareNextSegment();
+
+    /*!
+    ** Apply the retention: remove the segments older than the ttl,
+    ** then the oldest ones while the partition is too large. The
+    ** active segment is never removed. Old segments are detached
+    ** under a brief write lock, their files are deleted after it,
+    ** so writers never wait for a deletion. Meant to be called
+    ** periodically by a background janitor.
+    **
+    ** @param max_bytes_per_sec Limit the deletion rate, by sleeping
+    **          after each deleted segment (0 = no limit).
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error cleanOldSegments(int64_t max_bytes_per_sec = 0);
+
+    /*!
+    ** Get the number of messages written since the last flush.
+    **
+    ** @return The number of messages not flushed.
+    */
+    int64_t unflushedMessages() const;
+
+    /*!
+    ** Get the flushed offset: every offset before it is on the disk.
+    **
+    ** @return The flushed offset.
+    */
+    int64_t flushedOffset() const;
 
     /*!
     ** Get the newest offset of the partition.
@@ -100,6 +249,22 @@ namespace CommitLog
     */
     int64_t newestOffset() const;
 
+    /*!
+    ** Get the commit offset: the last offset readers can see
+    ** (-1 if none). Lock-free. Set from the log on open.
+    **
+    ** @return The commit offset.
+    */
+    int64_t commitOffset() const;
+
+    /*!
+    ** Set the commit offset, once offsets up to it are written.
+    ** Only called by the writer of the partition.
+    **
+    ** @param offset The new commit offset.
+    */
+    void setCommitOffset(int64_t offset);
+
     /*!
     ** Get the oldest offset of the partition.
     **
@@ -114,6 +279,29 @@ namespace CommitLog
     */
     Segment* activeSegment() const;
 
+    /*!
+    ** Get the number of segments.
+    **
+    ** @return The number of segments.
+    */
+    int64_t nbSegments() const;
+
+    /*!
+    ** Get the number of invalid bytes truncated at the end of
+    ** the segments (torn writes) by open.
+    **
+    ** @return The number of truncated bytes.
+    */
+    int64_t truncatedBytes() const;
+
+    /*!
+    ** Get the current recovery point, to save it in a checkpoint.
+    ** It is only on the disk once flushed: see flush.
+    **
+    ** @return The recovery point (base_offset = -1 if closed).
+    */
+    RecoveryPoint recoveryPoint() const;
+
     /*!
     ** Get an approximate physical size of the partition.
     **
@@ -122,8 +310,8 @@ namespace CommitLog
     int64_t physicalSize() const;
 
     /*!
-    ** Close all segments, and empty the segment
-    ** list (free'ing all segments).
+    ** Empty the segment list: the segments are closed once
+    ** freed (by the readers still using one, if any).
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
@@ -137,34 +325,138 @@ namespace CommitLog
     mykafka::Error deletePartition();
 
   private:
+    typedef std::vector<std::shared_ptr<Segment> > segments_type;
+
+  private:
+    /*!
+    ** Create a new active segment if the current one is full.
+    ** The write lock is only taken to publish it: the old one
+    ** is sealed after, by this writer or by the next
+    ** prepareNextSegment if the new one was a spare.
+    ** @warning Must be called with the append lock held.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error rollIfNeeded();
+
+    /*!
+    ** Create the next active segment: take the spare one if
+    ** ready, or open a new one.
+    ** @warning Must be called with the append lock held.
+    **
+    ** @param segment The new segment.
+    ** @param from_spare Set if it is the spare segment.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error openNextSegment(Segment*& segment, bool& from_spare);
+
     /*!
-    ** Remove old segments (either regarding size or timestamp).
+    ** Flush everything written so far, see flush.
+    ** @warning Must be called with the flush lock held.
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
-    mykafka::Error cleanOldSegments();
+    mykafka::Error flushLocked();
+
+    /*!
+    ** Wait until the given messages are on the disk, flushing them
+    ** if no other flush did. Called by the writer of these messages,
+    ** under a message policy.
+    **
+    ** @param first_offset The first offset written.
+    ** @param next_offset The offset after the last one written.
+    **
+    ** @return Error code 0 if no error, or the error of the
+    **         sync which failed to write them.
+    */
+    mykafka::Error waitFlushed(int64_t first_offset, int64_t next_offset);
+
+    /*!
+    ** Move the flushed offset forward (never backward).
+    **
+    ** @param next_offset The offset after the last one synced.
+    */
+    void advanceFlushedOffset(int64_t next_offset);
+
+    /*!
+    ** Remove the old segments from the list (either regarding
+    ** size or timestamp). They are not deleted yet.
+    ** @warning Must be called with the write lock held.
+    **
+    ** @param expired The segments removed.
+    */
+    void detachOldSegments(segments_type& expired);
+
+    /*!
+    ** Get the current segment list. Never blocks, and stays
+    ** valid (with its segments) even if a newer list is published.
+    **
+    ** @return The segment list.
+    */
+    std::shared_ptr<const segments_type> segmentsSnapshot() const;
+
+    /*!
+    ** Replace the segment list, seen by the next readers.
+    ** @warning Must be called with the write lock held.
+    **
+    ** @param segments The new segment list.
+    */
+    void publish(const std::shared_ptr<const segments_type>& segments);
 
     /*!
     ** Search for a segment containing offset.
     ** Try to find the closest segment where search_offset can be.
     **
-    ** @param found_segment The founded_segment or 0 if not found.
+    ** @param found_segment The founded_segment or null if not found.
+    ** @param segments The segment list to search in.
     ** @param search_offset The offset.
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
-    mykafka::Error findSegment(Segment*& found_segment, int64_t search_offset);
+    mykafka::Error findSegment(std::shared_ptr<Segment>& found_segment,
+                               const segments_type& segments, int64_t search_offset) const;
+
+    /*!
+    ** Find the segment of an offset, and read its payload (see readAt).
+    **
+    ** @param payload The payload.
+    ** @param offset The offset to read.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    template <typename T>
+    mykafka::Error readPayload(T& payload, int64_t offset);
 
   private:
     bool cancel_;
     int64_t max_segment_size_;
     int64_t max_partition_size_;
     int64_t segment_ttl_;
+    int64_t index_interval_bytes_;
     int64_t physical_size_;
+    int64_t truncated_bytes_;
+    int64_t flush_messages_;
+    int64_t flush_ms_;
+    std::atomic<int64_t> written_offset_; // Next offset written
+    std::atomic<int64_t> flushed_offset_; // Offsets before it are on the disk
+    std::atomic<int64_t> last_flush_ms_;
+    int64_t failed_from_; // Offsets in [failed_from_, failed_to_) hit a sync error
+    int64_t failed_to_;
+    mykafka::Error flush_error_;
+    std::atomic<int64_t> commit_offset_;
     std::atomic<Segment*> active_segment_;
     std::string path_;
     std::string name_;
-    std::vector<Segment*> segments_;
+    std::shared_ptr<const segments_type> segments_; // Use atomic load/store
+    std::shared_ptr<SegmentCache> segment_cache_;
+    Segment* spare_segment_;
+    bool spare_enabled_;
+    segments_type rolled_segments_; // Not sealed yet, see prepareNextSegment
+    boost::mutex rolled_mutex_;
+    boost::mutex spare_mutex_;
+    boost::mutex append_mutex_; // One writer at a time, taken before mutex_
+    boost::mutex flush_mutex_; // Taken before mutex_, never with append_mutex_
     mutable boost::shared_mutex mutex_;
   };
 } // CommitLog
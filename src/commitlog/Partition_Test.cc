@@ -5,11 +5,14 @@
 #include <boost/filesystem.hpp>
 
 #include "commitlog/Partition.hh"
+#include "commitlog/SegmentCache.hh"
 #include "utils/Utils.hh"
 #include "boost_test_helper.hh"
 
 #include <inttypes.h>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <thread>
 
 namespace
@@ -62,6 +65,20 @@ namespace
     }
   }
 
+  void writeBatchFrom(CommitLog::Partition& partition, int64_t nb_batch, int64_t batch_size)
+  {
+    const std::vector<std::vector<char> > batch(batch_size, v_payload);
+    for (int64_t i = 0; i < nb_batch; ++i)
+    {
+      const int64_t expected_offset = partition.newestOffset();
+      int64_t first_offset = -1;
+      auto res = partition.writeBatch(batch, first_offset);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      BOOST_CHECK_EQUAL(expected_offset, first_offset);
+      BOOST_CHECK_EQUAL(expected_offset + batch_size, partition.newestOffset());
+    }
+  }
+
   void writeAndReadFrom(CommitLog::Partition& partition, int64_t nb_payload, bool read)
   {
     writeFrom(partition, nb_payload);
@@ -241,11 +258,18 @@ BOOST_AUTO_TEST_CASE(test_partition_new_segment_reopen_with_reread)
 BOOST_AUTO_TEST_CASE(test_partition_with_max_size)
 {
   const std::string dir = tmp_path + "/test-maxsize";
-  writeAndReadPartition(dir, 100,
-                        max_segment_size * 10,
-                        max_segment_size * 10 * 2, false);
+  CommitLog::Partition partition(dir, max_segment_size * 10, max_segment_size * 10 * 2, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 100);
 
+  // Retention isn't applied on write.
+  BOOST_CHECK_EQUAL(countFiles(dir), 10 * 2);
+  res = partition.cleanOldSegments();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
   BOOST_CHECK_EQUAL(countFiles(dir), 2 * 2);
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 2);
+  BOOST_CHECK_EQUAL(partition.oldestOffset(), 88);
 }
 
 BOOST_AUTO_TEST_CASE(test_partition_with_ttl)
@@ -257,13 +281,574 @@ BOOST_AUTO_TEST_CASE(test_partition_with_ttl)
 
   std::this_thread::sleep_for(std::chrono::milliseconds(2000));
 
-  writeAndReadPartition(dir, 50,
-                        max_segment_size * 10,
-                        big_partition_size, false, 1 /* ttl = 1 sec */);
+  CommitLog::Partition partition(dir, max_segment_size * 10,
+                                 big_partition_size, 1 /* ttl = 1 sec */);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 50);
+  res = partition.cleanOldSegments();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
 
   BOOST_CHECK_EQUAL(countFiles(dir), 5 * 2);
 }
 
+BOOST_AUTO_TEST_CASE(test_partition_clean_rate_limit)
+{
+  const std::string dir = tmp_path + "/test-clean-rate-limit";
+  CommitLog::Partition partition(dir, max_segment_size * 10,
+                                 max_segment_size * 11, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 45);
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 5);
+
+  // 4 segments of 11 messages, at 44 messages per second.
+  const auto start = std::chrono::steady_clock::now();
+  res = partition.cleanOldSegments(max_segment_size * 44);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  BOOST_CHECK(elapsed >= std::chrono::milliseconds(900));
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 1);
+  BOOST_CHECK_EQUAL(countFiles(dir), 1 * 2);
+}
+
+// ============================
+
+BOOST_AUTO_TEST_CASE(test_partition_batch_one_segment)
+{
+  const std::string dir = tmp_path + "/test-batch1seg";
+  CommitLog::Partition partition(dir, max_segment_size * 100, big_partition_size, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  writeBatchFrom(partition, 10, 10);
+  readFrom(partition, 100);
+  BOOST_CHECK_EQUAL(partition.physicalSize(), max_segment_size * 100);
+  BOOST_CHECK_EQUAL(countFiles(dir), 1 * 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_batch_many_segment)
+{
+  const std::string dir = tmp_path + "/test-batch10seg";
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // A batch is never split, each batch of 11 fills a whole segment.
+  writeBatchFrom(partition, 10, 11);
+  writeFrom(partition, 5);
+  readFrom(partition, 115);
+  BOOST_CHECK_EQUAL(countFiles(dir), 11 * 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_range_many_segment)
+{
+  const std::string dir = tmp_path + "/test-range";
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // Segments of 11 messages (a segment is full when it exceeds its size).
+  writeFrom(partition, 35);
+
+  std::shared_ptr<const char> data;
+  std::vector<CommitLog::Segment::Record> records;
+  res = partition.readRange(data, records, 5, max_segment_size * 100, 100);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(records.size(), 6u); // Stop at the end of the segment
+
+  int64_t offset = 0;
+  while (offset < 35)
+  {
+    res = partition.readRange(data, records, offset, max_segment_size * 4, 100);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK(!records.empty() && records.size() <= 4);
+    for (auto& record : records)
+    {
+      BOOST_CHECK_EQUAL(record.offset, offset);
+      const std::string payload(data.get() + record.position, record.size);
+      BOOST_CHECK_EQUAL(payload, little_payload);
+      ++offset;
+    }
+  }
+  BOOST_CHECK_EQUAL(offset, 35);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_range_outlives_segment)
+{
+  const std::string dir = tmp_path + "/test-range-mapped";
+  auto cache = std::make_shared<CommitLog::SegmentCache>(1);
+  CommitLog::Partition partition(dir, max_segment_size * 10, max_segment_size * 20, 0, 0, cache);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 23);
+
+  // A range of a sealed segment points into its mapping.
+  std::shared_ptr<const char> data;
+  std::vector<CommitLog::Segment::Record> records;
+  res = partition.readRange(data, records, 0, max_segment_size * 100, 100);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(records.size(), 11u);
+
+  // Its segment is pinned: reading another one can't release it,
+  // and retention can only detach it.
+  std::string payload;
+  res = partition.readAt(payload, 12);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(payload, little_payload);
+  res = partition.cleanOldSegments();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.oldestOffset(), 11);
+
+  for (auto& record : records)
+  {
+    const std::string got(data.get() + record.position, record.size);
+    BOOST_CHECK_EQUAL(got, little_payload);
+  }
+
+  // Releasing the range deletes the segment.
+  BOOST_CHECK_EQUAL(countFiles(dir), 3 * 2);
+  data.reset();
+  BOOST_CHECK_EQUAL(countFiles(dir), 2 * 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_range_outlives_close)
+{
+  const std::string dir = tmp_path + "/test-range-close";
+  auto cache = std::make_shared<CommitLog::SegmentCache>(1);
+  CommitLog::Partition partition(dir, max_segment_size * 10, 0, 0, 0, cache);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 23);
+
+  std::shared_ptr<const char> data;
+  std::vector<CommitLog::Segment::Record> records;
+  res = partition.readRange(data, records, 0, max_segment_size * 100, 100);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(records.size(), 11u);
+
+  // The segment in use is closed by the range, once released.
+  res = partition.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  for (auto& record : records)
+  {
+    const std::string got(data.get() + record.position, record.size);
+    BOOST_CHECK_EQUAL(got, little_payload);
+  }
+  data.reset();
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_sealed_index_size)
+{
+  const std::string dir = tmp_path + "/test-sealed";
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // Segments of 11 messages, the active one is still growable.
+  writeFrom(partition, 35);
+  for (int64_t base_offset : {0, 11, 22})
+  {
+    char filename[64] = {0};
+    sprintf(filename, "/%020" PRId64 ".index", base_offset);
+    BOOST_CHECK_EQUAL(fs::file_size(dir + filename), 11 * CommitLog::Index::ENTRY_WIDTH);
+  }
+  BOOST_CHECK(fs::file_size(dir + "/00000000000000000033.index") >=
+              static_cast<uintmax_t>(CommitLog::Index::MIN_GROW_SIZE));
+  readFrom(partition, 35);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_sparse_index_reopen)
+{
+  const std::string dir = tmp_path + "/test-sparse";
+  {
+    CommitLog::Partition partition(dir, max_segment_size * 100, big_partition_size, 0,
+                                   max_segment_size * 8);
+    auto res = partition.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    writeFrom(partition, 250);
+    writeBatchFrom(partition, 5, 10);
+    readFrom(partition, 300);
+  }
+
+  CommitLog::Partition partition(dir, max_segment_size * 100, big_partition_size, 0,
+                                 max_segment_size * 8);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.newestOffset(), 300);
+  readFrom(partition, 300);
+  writeFrom(partition, 10);
+  readFrom(partition, 310);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_recovery_point)
+{
+  const std::string dir = tmp_path + "/test-recovery";
+  CommitLog::Partition::RecoveryPoint recovery_point{-1, -1, -1};
+  {
+    CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+    auto res = partition.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    writeFrom(partition, 30);
+    recovery_point = partition.recoveryPoint();
+    BOOST_CHECK_EQUAL(recovery_point.base_offset, 22);
+    BOOST_CHECK_EQUAL(recovery_point.next_offset, 30);
+    BOOST_CHECK_EQUAL(recovery_point.size, max_segment_size * 8);
+
+    // Written after the checkpoint: the tail and a new segment are checked.
+    writeFrom(partition, 10);
+  }
+
+  // Stale or invalid recovery points are ignored.
+  const std::vector<CommitLog::Partition::RecoveryPoint> recovery_points =
+    {
+      recovery_point,
+      {recovery_point.base_offset, recovery_point.next_offset + 1, recovery_point.size},
+      {recovery_point.base_offset, recovery_point.next_offset, max_segment_size * 1000},
+      {5, 8, max_segment_size * 3}
+    };
+  for (auto& point : recovery_points)
+  {
+    CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+    auto res = partition.open(point);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(partition.newestOffset(), 40);
+    BOOST_CHECK_EQUAL(partition.physicalSize(), max_segment_size * 40);
+    readFrom(partition, 40);
+  }
+
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+  auto res = partition.open(recovery_point);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 10);
+  readFrom(partition, 50);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_parallel_open)
+{
+  const std::string dir = tmp_path + "/test-parallel-open";
+  {
+    CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+    auto res = partition.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    writeFrom(partition, 500);
+  }
+
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+  auto res = partition.open(CommitLog::Partition::RecoveryPoint{-1, -1, -1}, 4);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 46);
+  BOOST_CHECK_EQUAL(partition.newestOffset(), 500);
+  BOOST_CHECK_EQUAL(partition.physicalSize(), max_segment_size * 500);
+  readFrom(partition, 500);
+  writeFrom(partition, 10);
+  readFrom(partition, 510);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_segment_cache)
+{
+  const std::string dir = tmp_path + "/test-segment-cache";
+  auto cache = std::make_shared<CommitLog::SegmentCache>(2);
+  const int64_t initial_fds = countFiles("/proc/self/fd");
+  {
+    CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0, 0, cache);
+    auto res = partition.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+    // 10 sealed segments, only the active one has its files open.
+    writeFrom(partition, 115);
+    BOOST_CHECK_EQUAL(partition.nbSegments(), 11);
+    BOOST_CHECK_EQUAL(cache->size(), 0);
+    BOOST_CHECK_EQUAL(countFiles("/proc/self/fd"), initial_fds + 3);
+
+    // Read segments are reopened, at most 2 stay open.
+    readFrom(partition, 115);
+    BOOST_CHECK_EQUAL(cache->size(), 2);
+    BOOST_CHECK_EQUAL(countFiles("/proc/self/fd"), initial_fds + 3 + 2 * 2);
+    readFrom(partition, 115);
+  }
+  BOOST_CHECK_EQUAL(cache->size(), 0);
+  BOOST_CHECK_EQUAL(countFiles("/proc/self/fd"), initial_fds);
+
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0, 0, cache);
+  auto res = partition.open(CommitLog::Partition::RecoveryPoint{-1, -1, -1}, 4);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(countFiles("/proc/self/fd"), initial_fds + 3);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i)
+    threads.emplace_back(std::thread([&partition]() { readFrom(partition, 115); }));
+  for (auto& thread : threads)
+    thread.join();
+  // Segments pinned by the other readers can't be released.
+  BOOST_CHECK(cache->size() <= 2 + 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_flush_messages)
+{
+  const std::string dir = tmp_path + "/test-flush-messages";
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0,
+                                 0, nullptr, 4, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  writeFrom(partition, 3);
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 3);
+  writeFrom(partition, 1);
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 0);
+  writeBatchFrom(partition, 1, 5);
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 0);
+
+  // A roll doesn't flush: the next flush syncs the sealed segment too.
+  writeFrom(partition, 3);
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 2);
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 3);
+  writeFrom(partition, 1);
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 0);
+  BOOST_CHECK_EQUAL(partition.flushedOffset(), 13);
+  readFrom(partition, 13);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_flush_messages_multithread)
+{
+  const std::string dir = tmp_path + "/test-flush-messages-multithread";
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0,
+                                 0, nullptr, 1, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // A write returns once its messages are on the disk, even if another
+  // writer's flush was syncing them.
+  std::atomic<int64_t> errors(0);
+  std::atomic<int64_t> not_flushed(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i)
+    threads.emplace_back(std::thread([&partition, &errors, &not_flushed, i]() {
+          const std::vector<std::vector<char> > batch(3, v_payload);
+          for (int j = 0; j < 50; ++j)
+          {
+            int64_t offset = -1;
+            auto res = (i + j) % 2 ? partition.write(v_payload, offset) :
+              partition.writeBatch(batch, offset);
+            const int64_t next_offset = offset + ((i + j) % 2 ? 1 : batch.size());
+            if (res.code() != mykafka::Error::OK)
+              ++errors;
+            else if (partition.flushedOffset() < next_offset)
+              ++not_flushed;
+          }
+        }));
+  for (auto& thread : threads)
+    thread.join();
+
+  BOOST_CHECK_EQUAL(errors, 0);
+  BOOST_CHECK_EQUAL(not_flushed, 0);
+  BOOST_CHECK_EQUAL(partition.newestOffset(), 4 * (25 + 25 * 3));
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_flush_sealed_segments)
+{
+  const std::string dir = tmp_path + "/test-flush-sealed";
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  // Without policy, nothing is synced by the rolls: a flush (before a
+  // checkpoint is saved) syncs the segments sealed since the last one.
+  writeFrom(partition, 23);
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 3);
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 23);
+  res = partition.flush();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 0);
+  BOOST_CHECK_EQUAL(partition.flushedOffset(), 23);
+
+  writeFrom(partition, 1);
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 3);
+  res = partition.flush();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.flushedOffset(), 24);
+  readFrom(partition, 24);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_flush_ms)
+{
+  const std::string dir = tmp_path + "/test-flush-ms";
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0,
+                                 0, nullptr, 0, 50);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+  writeFrom(partition, 5);
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 5);
+  res = partition.flushIfDue();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 5);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  res = partition.flushIfDue();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 0);
+
+  writeFrom(partition, 2);
+  res = partition.flush();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.unflushedMessages(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_prepare_next_segment)
+{
+  const std::string dir = tmp_path + "/test-prepare-next-segment";
+  {
+    CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+    auto res = partition.prepareNextSegment();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK(!fs::exists(dir + "/spare.log")); // Not opened yet
+
+    res = partition.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    res = partition.prepareNextSegment();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK(fs::exists(dir + "/spare.log"));
+    BOOST_CHECK(fs::exists(dir + "/spare.index"));
+
+    // The roll takes the spare segment.
+    writeFrom(partition, 12);
+    BOOST_CHECK_EQUAL(partition.nbSegments(), 2);
+    BOOST_CHECK(!fs::exists(dir + "/spare.log"));
+    BOOST_CHECK(fs::exists(dir + "/00000000000000000011.log"));
+    BOOST_CHECK(fs::exists(dir + "/00000000000000000011.index"));
+    BOOST_CHECK_EQUAL(partition.activeSegment()->baseOffset(), 11);
+    // The old segment is sealed by the next preparation, not by the writer.
+    BOOST_CHECK(fs::file_size(dir + "/00000000000000000000.index") >
+                static_cast<uintmax_t>(11 * CommitLog::Index::ENTRY_WIDTH));
+    readFrom(partition, 12);
+
+    // Without a spare segment, the roll opens a new one (and seals the old one).
+    writeFrom(partition, 11);
+    BOOST_CHECK_EQUAL(partition.nbSegments(), 3);
+    BOOST_CHECK_EQUAL(fs::file_size(dir + "/00000000000000000011.index"),
+                      11 * CommitLog::Index::ENTRY_WIDTH);
+    res = partition.prepareNextSegment();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(fs::file_size(dir + "/00000000000000000000.index"),
+                      11 * CommitLog::Index::ENTRY_WIDTH);
+    readFrom(partition, 23);
+  }
+  BOOST_CHECK(!fs::exists(dir + "/spare.log"));
+  BOOST_CHECK_EQUAL(countFiles(dir), 3 * 2);
+
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 3);
+  BOOST_CHECK_EQUAL(partition.newestOffset(), 23);
+  readFrom(partition, 23);
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_read_while_cleaning)
+{
+  const std::string dir = tmp_path + "/test-read-while-cleaning";
+  auto cache = std::make_shared<CommitLog::SegmentCache>(2);
+  CommitLog::Partition partition(dir, max_segment_size * 10, max_segment_size * 30, 0, 0, cache);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 50);
+
+  // Segments removed by the retention stay readable by the readers using them.
+  std::atomic<bool> stop(false);
+  std::atomic<int64_t> nb_errors(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i)
+    readers.emplace_back([&]()
+                         {
+                           std::vector<char> payload;
+                           while (!stop)
+                           {
+                             const int64_t offset = partition.oldestOffset();
+                             auto res = partition.readAt(payload, offset);
+                             if (res.code() != mykafka::Error::OK ||
+                                 std::string(payload.begin(), payload.end()) != little_payload)
+                               ++nb_errors;
+                           }
+                         });
+  for (int i = 0; i < 20; ++i)
+  {
+    writeFrom(partition, 11);
+    res = partition.cleanOldSegments();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+  stop = true;
+  for (auto& reader : readers)
+    reader.join();
+
+  // Only a read racing with a deletion may miss its (expired) offset.
+  BOOST_CHECK(partition.nbSegments() <= 4);
+  BOOST_CHECK_EQUAL(countFiles(dir), partition.nbSegments() * 2);
+  BOOST_TEST_MESSAGE("Reads of expired offsets: " << nb_errors);
+  readFrom(partition, partition.newestOffset() - partition.oldestOffset());
+}
+
+BOOST_AUTO_TEST_CASE(test_partition_read_while_rolling)
+{
+  const std::string dir = tmp_path + "/test-read-while-rolling";
+  auto cache = std::make_shared<CommitLog::SegmentCache>(2);
+  CommitLog::Partition partition(dir, max_segment_size * 10, big_partition_size, 0, 0, cache);
+  auto res = partition.open();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  writeFrom(partition, 20);
+
+  // Rolled segments are sealed out of the lock (by the writer, or the
+  // preparer if the roll took its spare) while readers use them.
+  std::atomic<bool> stop(false);
+  std::atomic<int64_t> nb_errors(0);
+  std::vector<std::thread> threads;
+  threads.emplace_back([&]()
+                       {
+                         while (!stop)
+                         {
+                           if (partition.prepareNextSegment().code() != mykafka::Error::OK)
+                             ++nb_errors;
+                           std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                         }
+                       });
+  for (int i = 0; i < 3; ++i)
+    threads.emplace_back([&]()
+                         {
+                           std::vector<char> payload;
+                           std::shared_ptr<const char> data;
+                           std::vector<CommitLog::Segment::Record> records;
+                           for (int64_t j = 0; !stop; ++j)
+                           {
+                             const int64_t offset = partition.newestOffset() - 1 - j % 20;
+                             auto res = partition.readAt(payload, offset);
+                             if (res.code() != mykafka::Error::OK ||
+                                 std::string(payload.begin(), payload.end()) != little_payload)
+                               ++nb_errors;
+                             res = partition.readRange(data, records, offset, 1024, 5);
+                             if (res.code() != mykafka::Error::OK || records.empty() ||
+                                 records[0].offset != offset)
+                               ++nb_errors;
+                           }
+                         });
+  writeFrom(partition, 300);
+  stop = true;
+  for (auto& thread : threads)
+    thread.join();
+
+  BOOST_CHECK_EQUAL(nb_errors, 0);
+  BOOST_CHECK_EQUAL(partition.nbSegments(), 30);
+  res = partition.prepareNextSegment();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  for (int64_t base_offset = 0; base_offset < 319; base_offset += 11)
+  {
+    char filename[64] = {0};
+    sprintf(filename, "/%020" PRId64 ".index", base_offset);
+    BOOST_CHECK_EQUAL(fs::file_size(dir + filename), 11 * CommitLog::Index::ENTRY_WIDTH);
+  }
+  readFrom(partition, 320);
+}
+
 // ============================
 
 BOOST_AUTO_TEST_CASE(test_partition_multithread)
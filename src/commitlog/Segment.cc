@@ -5,17 +5,27 @@
 #include <linux/limits.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <climits>
 #include <cassert>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <iostream>
 
 namespace CommitLog
 {
+  const int64_t Segment::HEADER_SIZE;
+
   namespace
   {
     std::string getIndexFilename(const std::string& path, int64_t base_offset)
     {
+      if (base_offset == Segment::SPARE_BASE_OFFSET)
+        return path + "/spare.index";
       char buffer[PATH_MAX] = {0};
       sprintf(buffer, "%s/%020" PRId64 ".index", path.c_str(), base_offset);
       return std::string(buffer);
@@ -23,28 +33,57 @@ namespace CommitLog
 
     std::string getLogFilename(const std::string& path, int64_t base_offset)
     {
+      if (base_offset == Segment::SPARE_BASE_OFFSET)
+        return path + "/spare.log";
       char buffer[PATH_MAX] = {0};
       sprintf(buffer, "%s/%020" PRId64 ".log", path.c_str(), base_offset);
       return std::string(buffer);
     }
+
+    int64_t getIndexSize(int64_t max_size, int64_t index_interval_bytes)
+    {
+      // Expect messages of 64 bytes on average, the index grows if needed.
+      int64_t size = max_size / 8;
+      if (index_interval_bytes > 0)
+        size = (max_size / index_interval_bytes + 1) * CommitLog::Index::ENTRY_WIDTH;
+      return std::min(CommitLog::Index::DEFAULT_SIZE,
+                      std::max(CommitLog::Index::MIN_GROW_SIZE, size));
+    }
   } // namespace
 
-  Segment::Segment(const std::string& filename, int64_t base_offset, int64_t max_size)
-    : fd_(-1), fd_read_(-1), next_offset_(base_offset), position_(0), physical_size_(0),
-      mtime_(0), max_size_(max_size), filename_(getLogFilename(filename, base_offset)),
-      index_(getIndexFilename(filename, base_offset), base_offset, 0 /* use default size */)
+  Segment::Segment(const std::string& filename, int64_t base_offset, int64_t max_size,
+                   int64_t index_interval_bytes, SegmentCache* cache)
+    : fd_(-1), fd_read_(-1), log_addr_(0), log_mapped_size_(0), next_offset_(base_offset),
+      position_(0), physical_size_(0), mtime_(0), truncated_bytes_(0), max_size_(max_size),
+      index_interval_bytes_(std::max<int64_t>(0, index_interval_bytes)),
+      last_index_position_(-1), path_(filename), filename_(getLogFilename(filename, base_offset)),
+      index_(getIndexFilename(filename, base_offset), base_offset,
+             getIndexSize(max_size, index_interval_bytes)),
+      cache_(cache), sealed_(false), delete_on_destroy_(false), resident_(false), pins_(0)
   {
     assert(sizeof (Entry) == HEADER_SIZE);
   }
 
   Segment::~Segment()
   {
-    close();
+    if (!delete_on_destroy_)
+    {
+      close();
+      return;
+    }
+
+    auto res = deleteSegment();
+    if (res.code() != mykafka::Error::OK)
+      std::cout << "Can't delete segment " << filename_ << ", error is: ["
+                << res.code() << "] " << res.msg() << std::endl;
   }
 
   mykafka::Error
-  Segment::open()
+  Segment::open(int64_t recovery_offset, int64_t recovery_position)
   {
+    sealed_ = false;
+    resident_ = true;
+    truncated_bytes_ = 0;
     auto res = index_.open();
     if (res.code() != mykafka::Error::OK)
       return res;
@@ -53,10 +92,6 @@ namespace CommitLog
     if (res.code() != mykafka::Error::OK)
       return res;
 
-    res = index_.truncateEntries(0);
-    if (res.code() != mykafka::Error::OK)
-      return res;
-
     fd_ = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
     if (fd_ < 0)
       return Utils::err(mykafka::Error::FILE_ERROR, "Can't"
@@ -84,7 +119,10 @@ namespace CommitLog
                         std::string(::strerror(errno)));
     }
 
-    res = reconstructIndexAndGetLastOffset();
+    if (recovery_offset >= 0)
+      res = recoverFrom(recovery_offset, recovery_position);
+    else
+      res = reconstructIndexAndGetLastOffset();
     if (res.code() != mykafka::Error::OK)
     {
       if (::close(fd_) < 0)
@@ -106,40 +144,161 @@ namespace CommitLog
   mykafka::Error
   Segment::reconstructIndexAndGetLastOffset()
   {
-    if (::lseek(fd_, 0, SEEK_SET) < 0)
-      return Utils::err(mykafka::Error::LOG_ERROR, "Can't seek"
-                        " at start of log " + filename_ + " because: " +
-                          std::string(::strerror(errno)));
+    // A crash can leave garbage after the last entry written.
+    auto res = index_.truncateEntries(index_.nbValidEntries());
+    if (res.code() != mykafka::Error::OK)
+      return res;
 
-    while (true)
+    int64_t offset = 0;
+    int64_t position = 0;
+    last_index_position_ = -1;
+    const int64_t nb_entries = index_.nbEntries();
+    if (nb_entries > 0)
     {
-      auto bytes = ::read(fd_, &next_offset_, OFFSET_SIZE);
-      if (bytes < 0)
-        return Utils::err(mykafka::Error::LOG_ERROR, "Can't read offset"
-                          " from log " + filename_  + " because: " +
-                          std::string(::strerror(errno)));
-      // End of file
-      if (bytes == 0)
-        break;
+      // Trust the index if its last entry points at a valid message.
+      int64_t last_offset = -1;
+      int64_t last_position = -1;
+      Entry entry{-1, -1};
+      if (index_.tryRead(last_offset, last_position,
+                         (nb_entries - 1) * CommitLog::Index::ENTRY_WIDTH) &&
+          last_position + HEADER_SIZE <= physical_size_ &&
+          ::pread(fd_read_, &entry, HEADER_SIZE, last_position) == HEADER_SIZE &&
+          entry.offset == last_offset && entry.size >= 0 &&
+          last_position + HEADER_SIZE + entry.size <= physical_size_)
+      {
+        offset = last_offset - index_.baseOffset() + 1;
+        position = last_position + HEADER_SIZE + entry.size;
+        last_index_position_ = last_position;
+      }
+      else
+      {
+        res = index_.truncateEntries(0);
+        if (res.code() != mykafka::Error::OK)
+          return res;
+      }
+    }
 
-      int32_t size = -1;
-      bytes = ::read(fd_, &size, SIZE_SIZE);
-      if (bytes <= 0)
-        return Utils::err(mykafka::Error::LOG_ERROR, "Can't read size"
-                          " from log " + filename_  + " because: " +
-                          std::string(::strerror(errno)));
+    return scanLog(offset, position);
+  }
 
-      auto res = index_.write(next_offset_, position_);
-      if (res.code() != mykafka::Error::OK)
-        return res;
+  mykafka::Error
+  Segment::assignBaseOffset(int64_t base_offset)
+  {
+    assert(position_ == 0 && next_offset_ == index_.baseOffset());
+    const std::string filename = getLogFilename(path_, base_offset);
+    if (::rename(filename_.c_str(), filename.c_str()) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR,
+                        "Can't rename log file " + filename_ + " because: " +
+                        std::string(::strerror(errno)));
+    filename_ = filename;
+
+    auto res = index_.rename(getIndexFilename(path_, base_offset), base_offset);
+    if (res.code() != mykafka::Error::OK)
+      return res;
+    next_offset_ = base_offset;
+    mtime_ = ::time(0); // The ttl starts now, as for a segment created on roll
+
+    return Utils::err(mykafka::Error::OK);
+  }
 
-      position_ += size + HEADER_SIZE;
-      ++next_offset_;
+  mykafka::Error
+  Segment::recoverFrom(int64_t recovery_offset, int64_t recovery_position)
+  {
+    if (recovery_position < 0)
+      recovery_position = physical_size_;
+    if (recovery_offset < index_.baseOffset() || recovery_position > physical_size_)
+      return reconstructIndexAndGetLastOffset();
 
-      if (::lseek(fd_, size, SEEK_CUR) < 0)
+    // Never truncate valid messages because of a stale recovery point.
+    Entry entry{-1, -1};
+    if (recovery_position + HEADER_SIZE <= physical_size_ &&
+        (::pread(fd_read_, &entry, HEADER_SIZE, recovery_position) != HEADER_SIZE ||
+         entry.offset != recovery_offset))
+      return reconstructIndexAndGetLastOffset();
+
+    // Keep the entries before the recovery point, the scan adds the others.
+    int64_t begin = 0;
+    int64_t end = index_.nbValidEntries();
+    int64_t last_position = -1;
+    while (begin < end)
+    {
+      int64_t rel_offset = -1;
+      int64_t rel_position = -1;
+      const int64_t pos = (begin + end) / 2;
+      if (!index_.tryRead(rel_offset, rel_position, pos * CommitLog::Index::ENTRY_WIDTH))
+        return reconstructIndexAndGetLastOffset();
+      if (rel_position < recovery_position)
+      {
+        begin = pos + 1;
+        last_position = std::max(last_position, rel_position);
+      }
+      else
+        end = pos;
+    }
+
+    // The index must cover the trusted part of the log.
+    const bool dense = index_interval_bytes_ == 0;
+    if ((dense && begin != recovery_offset - index_.baseOffset()) ||
+        (!dense && begin == 0 && recovery_position > 0))
+      return reconstructIndexAndGetLastOffset();
+
+    auto res = index_.truncateEntries(begin);
+    if (res.code() != mykafka::Error::OK)
+      return res;
+    last_index_position_ = begin > 0 ? last_position : -1;
+
+    return scanLog(recovery_offset - index_.baseOffset(), recovery_position);
+  }
+
+  mykafka::Error
+  Segment::scanLog(int64_t relative_offset, int64_t position)
+  {
+    const int64_t chunk_size = 64 * 1024;
+    std::vector<char> buffer;
+    int64_t buffer_start = position;
+    while (position + HEADER_SIZE <= physical_size_)
+    {
+      if (position + HEADER_SIZE > buffer_start + static_cast<int64_t>(buffer.size()))
+      {
+        const int64_t bytes = std::min(chunk_size, physical_size_ - position);
+        buffer.resize(bytes);
+        if (::pread(fd_read_, &buffer[0], bytes, position) != bytes)
+          return Utils::err(mykafka::Error::LOG_ERROR, "Can't read log " + filename_ +
+                            " at " + std::to_string(position) + " because: " +
+                            std::string(::strerror(errno)));
+        buffer_start = position;
+      }
+
+      const Entry* entry = reinterpret_cast<const Entry*>(&buffer[position - buffer_start]);
+      if (entry->offset != index_.baseOffset() + relative_offset || entry->size < 0 ||
+          position + HEADER_SIZE + entry->size > physical_size_)
         break;
+
+      if (needIndexEntry(position))
+      {
+        auto res = index_.write(entry->offset, position);
+        if (res.code() != mykafka::Error::OK)
+          return res;
+        last_index_position_ = position;
+      }
+
+      position += HEADER_SIZE + entry->size;
+      ++relative_offset;
     }
 
+    // Drop a message partially written before a crash.
+    if (position < physical_size_)
+    {
+      if (::ftruncate(fd_, position) < 0)
+        return Utils::err(mykafka::Error::LOG_ERROR, "Can't truncate log " + filename_ +
+                          " because: " + std::string(::strerror(errno)));
+      truncated_bytes_ = physical_size_ - position;
+      physical_size_ = position;
+    }
+
+    next_offset_ = index_.baseOffset() + relative_offset;
+    position_ = position;
+
     return Utils::err(mykafka::Error::OK);
   }
 
@@ -156,9 +315,13 @@ namespace CommitLog
                         " to log " + filename_  + " because: " +
                           std::string(::strerror(errno)));
 
-    auto res  = index_.write(next_offset_, position_);
-    if (res.code() != mykafka::Error::OK)
-      return res;
+    if (needIndexEntry(position_))
+    {
+      auto res  = index_.write(next_offset_, position_);
+      if (res.code() != mykafka::Error::OK)
+        return res;
+      last_index_position_ = position_;
+    }
 
     offset = next_offset_;
     ++next_offset_;
@@ -175,7 +338,63 @@ namespace CommitLog
   }
 
   mykafka::Error
-  Segment::readAt(std::vector<char>& payload, int64_t relative_offset)
+  Segment::writeBatch(const std::vector<std::vector<char> >& payloads, int64_t& first_offset)
+  {
+    first_offset = next_offset_;
+    if (payloads.empty())
+      return Utils::err(mykafka::Error::OK);
+
+    const int64_t nb = payloads.size();
+    std::vector<Entry> headers(nb);
+    std::vector<struct iovec> iov(nb * 2);
+    std::vector<std::pair<int64_t, int64_t> > entries;
+    entries.reserve(index_interval_bytes_ == 0 ? nb : 0);
+    int64_t position = position_;
+    int64_t last_index_position = last_index_position_;
+    for (int64_t i = 0; i < nb; ++i)
+    {
+      const int32_t payload_size = payloads[i].size();
+      headers[i] = Entry{next_offset_ + i, payload_size};
+      iov[i * 2].iov_base = &headers[i];
+      iov[i * 2].iov_len = HEADER_SIZE;
+      iov[i * 2 + 1].iov_base = const_cast<char*>(payloads[i].data());
+      iov[i * 2 + 1].iov_len = payload_size;
+      if (index_interval_bytes_ == 0 || last_index_position < 0 ||
+          position - last_index_position >= index_interval_bytes_)
+      {
+        entries.push_back(std::make_pair(next_offset_ + i, position));
+        last_index_position = position;
+      }
+      position += HEADER_SIZE + payload_size;
+    }
+
+    for (int64_t begin = 0; begin < nb * 2; begin += IOV_MAX)
+    {
+      const int64_t count = std::min<int64_t>(IOV_MAX, nb * 2 - begin);
+      ssize_t expected = 0;
+      for (int64_t i = begin; i < begin + count; ++i)
+        expected += iov[i].iov_len;
+      if (::writev(fd_, &iov[begin], count) != expected)
+        return Utils::err(mykafka::Error::LOG_ERROR, "Can't write batch"
+                          " to log " + filename_  + " because: " +
+                          std::string(::strerror(errno)));
+    }
+
+    auto res = index_.writeBatch(entries);
+    if (res.code() != mykafka::Error::OK)
+      return res;
+
+    last_index_position_ = last_index_position;
+    next_offset_ += nb;
+    physical_size_ += position - position_;
+    position_ = position;
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  template <typename T>
+  mykafka::Error
+  Segment::readPayload(T& payload, int64_t relative_offset)
   {
     int64_t rel_offset = -1;
     int64_t rel_position = -1;
@@ -187,20 +406,28 @@ namespace CommitLog
                         std::to_string(relative_offset) +
                         " when reading log " + filename_);
 
-    if (::lseek(fd_read_, rel_position, SEEK_SET) < 0)
-      return Utils::err(mykafka::Error::LOG_ERROR, "Can't seek at " +
-                        std::to_string(rel_position) +
-                        " in payload when reading " + filename_ + " because: " +
-                          std::string(::strerror(errno)));
+    if (log_addr_)
+    {
+      const char* addr = static_cast<const char*>(log_addr_) + rel_position;
+      const Entry* entry = reinterpret_cast<const Entry*>(addr);
+      if (rel_position + HEADER_SIZE > log_mapped_size_ || entry->offset < 0 ||
+          entry->size < 0 || rel_position + HEADER_SIZE + entry->size > log_mapped_size_)
+        return Utils::err(mykafka::Error::LOG_ERROR, "Invalid offset/size at " +
+                          std::to_string(rel_position) +
+                          " when reading log " + filename_);
+      payload.assign(addr + HEADER_SIZE, addr + HEADER_SIZE + entry->size);
+      return Utils::err(mykafka::Error::OK);
+    }
 
     Entry entry{-1, -1};
-    if (::read(fd_read_, &entry, HEADER_SIZE) < 0 || entry.offset < 0 || entry.size < 0)
+    if (::pread(fd_read_, &entry, HEADER_SIZE, rel_position) != HEADER_SIZE ||
+        entry.offset < 0 || entry.size < 0)
       return Utils::err(mykafka::Error::LOG_ERROR, "Can't read offset/size "
                         "from log " + filename_ + " because: " +
                           std::string(::strerror(errno)));
 
     payload.resize(entry.size);
-    auto bytes = ::read(fd_read_, &payload[0], entry.size);
+    auto bytes = ::pread(fd_read_, &payload[0], entry.size, rel_position + HEADER_SIZE);
     if (bytes != entry.size)
       return Utils::err(mykafka::Error::LOG_ERROR, "Can't read payload "
                         "from log " + filename_ + "! (" +
@@ -211,6 +438,291 @@ namespace CommitLog
     return Utils::err(mykafka::Error::OK);
   }
 
+  mykafka::Error
+  Segment::readAt(std::vector<char>& payload, int64_t relative_offset)
+  {
+    return readPayload(payload, relative_offset);
+  }
+
+  mykafka::Error
+  Segment::readAt(std::string& payload, int64_t relative_offset)
+  {
+    return readPayload(payload, relative_offset);
+  }
+
+  mykafka::Error
+  Segment::readRange(std::vector<char>& buffer, const char*& data,
+                     std::vector<Record>& records, int64_t relative_offset,
+                     int64_t max_bytes, int64_t max_messages)
+  {
+    records.clear();
+    data = 0;
+    int64_t rel_offset = -1;
+    int64_t rel_position = -1;
+    auto res = findEntry(rel_offset, rel_position, relative_offset);
+    if (res.code() != mykafka::Error::OK)
+      return res;
+    if (rel_offset == -1 || rel_position == -1)
+      return Utils::err(mykafka::Error::LOG_ERROR, "Can't find offset " +
+                        std::to_string(relative_offset) +
+                        " when reading log " + filename_);
+
+    const int64_t available = (log_addr_ ? log_mapped_size_ : position_) - rel_position;
+    const int64_t expected_offset = relative_offset + index_.baseOffset();
+    int64_t bytes = std::min(std::max<int64_t>(max_bytes, HEADER_SIZE), available);
+    int64_t end = 0;
+    res = readLog(buffer, data, rel_position, bytes);
+    if (res.code() == mykafka::Error::OK)
+      res = scanRecords(records, end, data, bytes, expected_offset, max_messages, rel_position);
+
+    // The first record is always sent, even if bigger than max_bytes.
+    if (res.code() == mykafka::Error::OK && records.empty() &&
+        max_messages > 0 && bytes >= HEADER_SIZE)
+    {
+      const Entry* entry = reinterpret_cast<const Entry*>(data);
+      if (HEADER_SIZE + entry->size <= available)
+      {
+        bytes = HEADER_SIZE + entry->size;
+        res = readLog(buffer, data, rel_position, bytes);
+        if (res.code() == mykafka::Error::OK)
+          res = scanRecords(records, end, data, bytes, expected_offset, max_messages,
+                            rel_position);
+      }
+    }
+    if (!log_addr_)
+      buffer.resize(end);
+
+    return res;
+  }
+
+  mykafka::Error
+  Segment::readLog(std::vector<char>& buffer, const char*& data,
+                   int64_t position, int64_t bytes) const
+  {
+    if (log_addr_)
+    {
+      data = static_cast<const char*>(log_addr_) + position;
+      return Utils::err(mykafka::Error::OK);
+    }
+
+    buffer.resize(bytes);
+    auto got = ::pread(fd_read_, &buffer[0], bytes, position);
+    if (got != bytes)
+      return Utils::err(mykafka::Error::LOG_ERROR, "Can't read range "
+                        "from log " + filename_ + "! (" +
+                        std::to_string(got) + " != " +
+                        std::to_string(bytes) + ")" + " error is: " +
+                        std::string(::strerror(errno)));
+    data = &buffer[0];
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Segment::scanRecords(std::vector<Record>& records, int64_t& end,
+                       const char* data, int64_t bytes, int64_t first_offset,
+                       int64_t max_messages, int64_t rel_position) const
+  {
+    records.clear();
+    end = 0;
+    while (end + HEADER_SIZE <= bytes &&
+           static_cast<int64_t>(records.size()) < max_messages)
+    {
+      const Entry* entry = reinterpret_cast<const Entry*>(data + end);
+      if (entry->offset != first_offset + static_cast<int64_t>(records.size()) ||
+          entry->size < 0)
+        return Utils::err(mykafka::Error::LOG_ERROR, "Invalid offset/size at " +
+                          std::to_string(rel_position + end) +
+                          " when reading log " + filename_);
+      if (end + HEADER_SIZE + entry->size > bytes)
+        break;
+
+      records.push_back(Record{entry->offset, end + HEADER_SIZE, entry->size});
+      end += HEADER_SIZE + entry->size;
+    }
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Segment::seal()
+  {
+    // Not while a reader uses the segment as written.
+    boost::lock_guard<boost::shared_mutex> seal_lock(seal_mutex_);
+    if (sealed_)
+      return Utils::err(mykafka::Error::OK);
+
+    auto res = index_.seal();
+    if (res.code() != mykafka::Error::OK)
+      return res;
+    if (!cache_)
+    {
+      res = mapLog();
+      if (res.code() == mykafka::Error::OK)
+        sealed_ = true;
+      return res;
+    }
+
+    // Nothing is written anymore, reads reopen what they need.
+    if (fd_ >= 0 && ::close(fd_) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR,
+                        "Can't close log file " + filename_ + " because: " +
+                        std::string(::strerror(errno)));
+    fd_ = -1;
+
+    boost::lock_guard<boost::mutex> lock(resident_mutex_);
+    sealed_ = true;
+    closeResidentFiles();
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Segment::flush()
+  {
+    // Sealed, with its files released: nothing is written anymore.
+    if (fd_ < 0)
+      return Utils::err(mykafka::Error::OK);
+
+    if (::fdatasync(fd_) < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR,
+                        "Can't flush log file " + filename_ + " because: " +
+                        std::string(::strerror(errno)));
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  mykafka::Error
+  Segment::syncLog() const
+  {
+    const int fd = ::open(filename_.c_str(), O_RDONLY);
+    if (fd < 0)
+      return Utils::err(mykafka::Error::FILE_ERROR,
+                        "Can't open log file " + filename_ + " to flush it because: " +
+                        std::string(::strerror(errno)));
+
+    auto res = Utils::err(mykafka::Error::OK);
+    if (::fdatasync(fd) < 0)
+      res = Utils::err(mykafka::Error::FILE_ERROR,
+                       "Can't flush log file " + filename_ + " because: " +
+                       std::string(::strerror(errno)));
+    ::close(fd);
+    return res;
+  }
+
+  mykafka::Error
+  Segment::pin()
+  {
+    if (!sealed_)
+    {
+      // Held until unpin: the segment can't be sealed meanwhile.
+      seal_mutex_.lock_shared();
+      if (!sealed_)
+        return Utils::err(mykafka::Error::OK);
+      seal_mutex_.unlock_shared();
+    }
+    if (!cache_)
+      return Utils::err(mykafka::Error::OK);
+
+    {
+      boost::lock_guard<boost::mutex> lock(resident_mutex_);
+      if (!resident_)
+      {
+        fd_read_ = ::open(filename_.c_str(), O_RDONLY);
+        if (fd_read_ < 0)
+          return Utils::err(mykafka::Error::FILE_ERROR, "Can't"
+                            " reopen read-only log " + filename_ + " because: " +
+                            std::string(::strerror(errno)));
+        auto res = index_.openSealed();
+        if (res.code() == mykafka::Error::OK)
+        {
+          res = mapLog();
+          if (res.code() != mykafka::Error::OK)
+            index_.close();
+        }
+        if (res.code() != mykafka::Error::OK)
+        {
+          ::close(fd_read_);
+          fd_read_ = -1;
+          return res;
+        }
+        resident_ = true;
+      }
+      ++pins_;
+    }
+    cache_->touch(this);
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  void
+  Segment::unpin()
+  {
+    if (!sealed_)
+    {
+      seal_mutex_.unlock_shared();
+      return;
+    }
+    if (!cache_)
+      return;
+
+    boost::lock_guard<boost::mutex> lock(resident_mutex_);
+    --pins_;
+  }
+
+  bool
+  Segment::release()
+  {
+    boost::lock_guard<boost::mutex> lock(resident_mutex_);
+    if (pins_ > 0)
+      return false;
+
+    closeResidentFiles();
+    return true;
+  }
+
+  void
+  Segment::closeResidentFiles()
+  {
+    if (!resident_)
+      return;
+
+    // Read-only files: nothing is lost if the close fails.
+    unmapLog();
+    if (fd_read_ >= 0)
+      ::close(fd_read_);
+    fd_read_ = -1;
+    index_.close();
+    resident_ = false;
+  }
+
+  mykafka::Error
+  Segment::mapLog()
+  {
+    if (log_addr_ || position_ == 0)
+      return Utils::err(mykafka::Error::OK);
+
+    void* addr = ::mmap(0, position_, PROT_READ, MAP_SHARED, fd_read_, 0);
+    if (addr == MAP_FAILED)
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't mmap log " +
+                        filename_ + " because: " + std::string(::strerror(errno)));
+    log_addr_ = addr;
+    log_mapped_size_ = position_;
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  void
+  Segment::unmapLog()
+  {
+    if (!log_addr_)
+      return;
+
+    // Read-only mapping: nothing is lost if the unmap fails.
+    ::munmap(log_addr_, log_mapped_size_);
+    log_addr_ = 0;
+    log_mapped_size_ = 0;
+  }
+
   bool
   Segment::isFull() const
   {
@@ -220,22 +732,35 @@ namespace CommitLog
   mykafka::Error
   Segment::close()
   {
+    if (sealed_ && cache_)
+    {
+      // The files may be released already.
+      cache_->remove(this);
+      boost::lock_guard<boost::mutex> lock(resident_mutex_);
+      closeResidentFiles();
+    }
+    sealed_ = false;
+
+    unmapLog();
+
     // Already closed!
-    if (fd_ < 0)
+    if (fd_ < 0 && fd_read_ < 0)
       return Utils::err(mykafka::Error::OK);
 
-    if (::close(fd_) < 0)
+    if (fd_ >= 0 && ::close(fd_) < 0)
       return Utils::err(mykafka::Error::FILE_ERROR,
                         "Can't close log file " + filename_ + " because: " +
                           std::string(::strerror(errno)));
-    if (::close(fd_read_) < 0)
+    if (fd_read_ >= 0 && ::close(fd_read_) < 0)
       return Utils::err(mykafka::Error::FILE_ERROR,
                         "Can't close read-only log file " + filename_ +
                         " because: " + std::string(::strerror(errno)));
 
+    resident_ = false;
     fd_ = -1;
     fd_read_ = -1;
     position_ = 0;
+    last_index_position_ = -1;
     mtime_ = 0;
     physical_size_ = 0;
     return index_.close();
@@ -253,8 +778,38 @@ namespace CommitLog
     return index_.deleteIndex();
   }
 
+  void
+  Segment::deleteOnDestroy()
+  {
+    delete_on_destroy_ = true;
+  }
+
   mykafka::Error
   Segment::findEntry(int64_t& rel_offset, int64_t& rel_position, int64_t search_offset) const
+  {
+    const int64_t nb_entries = next_offset_ - index_.baseOffset();
+    if (search_offset < 0 || search_offset >= nb_entries)
+    {
+      rel_offset = -1;
+      rel_position = -1;
+      return Utils::err(mykafka::Error::OK);
+    }
+
+    if (index_interval_bytes_ > 0)
+      return scanEntry(rel_offset, rel_position, search_offset);
+
+    if (index_.tryRead(rel_offset, rel_position, search_offset * CommitLog::Index::ENTRY_WIDTH) &&
+        rel_offset - index_.baseOffset() == search_offset)
+    {
+      rel_offset = search_offset;
+      return Utils::err(mykafka::Error::OK);
+    }
+
+    return searchEntry(rel_offset, rel_position, search_offset);
+  }
+
+  mykafka::Error
+  Segment::searchEntry(int64_t& rel_offset, int64_t& rel_position, int64_t search_offset) const
   {
     int64_t begin = 0;
     int64_t end = (next_offset_ - index_.baseOffset()) - 1;
@@ -263,10 +818,9 @@ namespace CommitLog
 
     while (begin <= end && rel_offset != search_offset)
     {
-      auto res = index_.read(rel_offset, rel_position, pos * CommitLog::Index::ENTRY_WIDTH);
+      if (!index_.tryRead(rel_offset, rel_position, pos * CommitLog::Index::ENTRY_WIDTH))
+        return Utils::err(mykafka::Error::INDEX_ERROR, "Read overflow!");
       rel_offset -= index_.baseOffset();
-      if (res.code() != mykafka::Error::OK)
-        return res;
       if (rel_offset > search_offset)
         end = pos - 1;
       else
@@ -283,6 +837,79 @@ namespace CommitLog
     return Utils::err(mykafka::Error::OK);
   }
 
+  mykafka::Error
+  Segment::scanEntry(int64_t& rel_offset, int64_t& rel_position, int64_t search_offset) const
+  {
+    rel_offset = -1;
+    rel_position = -1;
+
+    // Closest indexed entry before the searched offset.
+    int64_t begin = 0;
+    int64_t end = index_.nbEntries() - 1;
+    int64_t offset = -1;
+    int64_t position = -1;
+    while (begin <= end)
+    {
+      const int64_t pos = (begin + end) / 2;
+      int64_t entry_offset = -1;
+      int64_t entry_position = -1;
+      if (!index_.tryRead(entry_offset, entry_position, pos * CommitLog::Index::ENTRY_WIDTH))
+        return Utils::err(mykafka::Error::INDEX_ERROR, "Read overflow!");
+      entry_offset -= index_.baseOffset();
+      if (entry_offset <= search_offset)
+      {
+        offset = entry_offset;
+        position = entry_position;
+        begin = pos + 1;
+      }
+      else
+        end = pos - 1;
+    }
+    if (offset < 0)
+      return Utils::err(mykafka::Error::INDEX_ERROR, "No index entry before offset " +
+                        std::to_string(search_offset) + " in " + index_.filename());
+
+    // Then scan the log, one chunk at a time.
+    const int64_t chunk_size = std::max<int64_t>(index_interval_bytes_, 4096) + HEADER_SIZE;
+    std::vector<char> buffer;
+    int64_t buffer_start = position;
+    while (position + HEADER_SIZE <= position_)
+    {
+      if (position + HEADER_SIZE > buffer_start + static_cast<int64_t>(buffer.size()))
+      {
+        const int64_t bytes = std::min(chunk_size, position_ - position);
+        buffer.resize(bytes);
+        if (::pread(fd_read_, &buffer[0], bytes, position) != bytes)
+          return Utils::err(mykafka::Error::LOG_ERROR, "Can't read log " + filename_ +
+                            " at " + std::to_string(position) + " because: " +
+                            std::string(::strerror(errno)));
+        buffer_start = position;
+      }
+
+      const Entry* entry = reinterpret_cast<const Entry*>(&buffer[position - buffer_start]);
+      if (entry->offset - index_.baseOffset() != offset || entry->size < 0)
+        return Utils::err(mykafka::Error::LOG_ERROR, "Invalid offset/size at " +
+                          std::to_string(position) + " when scanning log " + filename_);
+      if (offset == search_offset)
+      {
+        rel_offset = offset;
+        rel_position = position;
+        break;
+      }
+      position += HEADER_SIZE + entry->size;
+      ++offset;
+    }
+
+    return Utils::err(mykafka::Error::OK);
+  }
+
+  bool
+  Segment::needIndexEntry(int64_t position) const
+  {
+    return index_interval_bytes_ == 0 || last_index_position_ < 0 ||
+      position - last_index_position_ >= index_interval_bytes_;
+  }
+
   int
   Segment::segmentFd() const
   {
@@ -313,6 +940,18 @@ namespace CommitLog
     return physical_size_;
   }
 
+  int64_t
+  Segment::truncatedBytes() const
+  {
+    return truncated_bytes_;
+  }
+
+  bool
+  Segment::isMapped() const
+  {
+    return log_addr_ != 0;
+  }
+
   int64_t
   Segment::mtime() const
   {
@@ -326,25 +965,21 @@ namespace CommitLog
     int64_t rel_position = -1;
     for (int64_t offset = 0; offset < (next_offset_ - index_.baseOffset()); ++offset)
     {
-      auto res = index_.read(rel_offset, rel_position, offset * CommitLog::Index::ENTRY_WIDTH);
+      auto res = findEntry(rel_offset, rel_position, offset);
       if (res.code() != mykafka::Error::OK)
         return res;
       out << "For offset " << offset << ", using rel_offset=" << rel_offset
           << " and rel_position=" << rel_position << "\n";
 
-      if (::lseek(fd_read_, rel_position, SEEK_SET) < 0)
-        return Utils::err(mykafka::Error::LOG_ERROR, "Can't seek at " +
-                          std::to_string(rel_position) +
-                          " in payload when reading " + filename_ + " because: " +
-                          std::string(::strerror(errno)));
       Entry entry{-1, -1};
-      if (::read(fd_read_, &entry, HEADER_SIZE) < 0 || entry.offset < 0 || entry.size < 0)
+      if (::pread(fd_read_, &entry, HEADER_SIZE, rel_position) != HEADER_SIZE ||
+          entry.offset < 0 || entry.size < 0)
         return Utils::err(mykafka::Error::LOG_ERROR, "Can't read offset/size "
                           "from log " + filename_ + " because: " +
-                          std::string(::strerror(errno)));;
+                          std::string(::strerror(errno)));
       std::vector<char> payload;
       payload.resize(entry.size);
-      auto bytes = ::read(fd_read_, &payload[0], entry.size);
+      auto bytes = ::pread(fd_read_, &payload[0], entry.size, rel_position + HEADER_SIZE);
       if (bytes != entry.size)
         return Utils::err(mykafka::Error::LOG_ERROR, "Can't read payload "
                           "from log " + filename_ + "! (" +
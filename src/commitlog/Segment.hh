@@ -2,9 +2,15 @@
 # define COMMIT_LOG_SEGMENT_HH_
 
 # include <vector>
+# include <atomic>
 
 # include "mykafka.pb.h"
 # include "commitlog/Index.hh"
+# include "commitlog/SegmentCache.hh"
+
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/shared_mutex.hpp>
+# include <boost/thread/locks.hpp>
 
 namespace CommitLog
 {
@@ -30,6 +36,21 @@ namespace CommitLog
     static const int64_t OFFSET_SIZE = 8;
     static const int64_t SIZE_SIZE = 4;
     static const int64_t HEADER_SIZE = OFFSET_SIZE + SIZE_SIZE;
+    static const int64_t SPARE_BASE_OFFSET = -1; // Opened ahead, see assignBaseOffset
+
+  public:
+    /*!
+    ** @struct Record
+    **
+    ** A record read by readRange. Its payload lives in
+    ** the buffer given to readRange, at position.
+    */
+    struct Record
+    {
+      int64_t offset;
+      int64_t position;
+      int32_t size;
+    };
 
   public:
     /*!
@@ -38,8 +59,13 @@ namespace CommitLog
     ** @param filename The file name.
     ** @param base_offset The base offset.
     ** @param max_size The max size for this segment.
+    ** @param index_interval_bytes Write an index entry every N bytes
+    **          of log (0 = one entry per message).
+    ** @param cache Where to register the segment once sealed, so its
+    **          files are only open while recently read (0 = always open).
     */
-    Segment(const std::string& filename, int64_t base_offset, int64_t max_size);
+    Segment(const std::string& filename, int64_t base_offset, int64_t max_size,
+            int64_t index_interval_bytes = 0, SegmentCache* cache = 0);
 
     /*!
     ** Close all files own.
@@ -52,13 +78,39 @@ namespace CommitLog
     ** Create internal index file.
     ** Create a log file.
     **
+    ** A recovery point (usually from a checkpoint) can be given:
+    ** the log is then trusted up to it, and only what follows is
+    ** scanned. If it doesn't match the files, the whole index is
+    ** reconstructed as usual.
+    **
+    ** @param recovery_offset The next offset at the recovery
+    **          point (-1 = no recovery point).
+    ** @param recovery_position The log size at the recovery
+    **          point (-1 = the whole log is trusted).
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error open(int64_t recovery_offset = -1, int64_t recovery_position = -1);
+
+    /*!
+    ** Give a spare segment (opened ahead with SPARE_BASE_OFFSET)
+    ** its base offset, when it becomes the active segment. Its
+    ** files are renamed, nothing else has to be done.
+    ** @warning The segment must be empty.
+    **
+    ** @param base_offset The base offset.
+    **
     ** @return Error code 0 if no error, or a detailed error.
     */
-    mykafka::Error open();
+    mykafka::Error assignBaseOffset(int64_t base_offset);
 
     /*!
     ** Reconstruct index from its log.
     ** Ensure index and log are synced. Get the last offset.
+    ** The persisted index is trusted if its last entry points at a
+    ** valid message, then only the log after it is scanned. Otherwise
+    ** the whole index is rebuilt. A torn message at the end of the
+    ** log (crash during a write) is truncated (see truncatedBytes).
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
@@ -77,8 +129,23 @@ namespace CommitLog
     mykafka::Error write(const char* payload, int32_t payload_size, int64_t& offset);
     mykafka::Error write(const std::vector<char>& payload, int64_t& offset);
 
+    /*!
+    ** Write at the end of the segment, all the given payloads.
+    ** Offsets are contiguous, starting at first_offset. Headers and
+    ** payloads are sent with a single vectored write (split only if
+    ** the batch exceeds IOV_MAX), and the index is updated in one pass.
+    **
+    ** @param payloads The payloads to append.
+    ** @param first_offset The offset of the first written payload.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error writeBatch(const std::vector<std::vector<char> >& payloads,
+                              int64_t& first_offset);
+
     /*!
     ** Read segment at the specified.
+    ** A sealed segment is read from its mapping, without syscall.
     **
     ** @param payload The payload to append.
     ** @param relative_offset The offset to read.
@@ -86,6 +153,81 @@ namespace CommitLog
     ** @return Error code 0 if no error, or a detailed error.
     */
     mykafka::Error readAt(std::vector<char>& payload, int64_t relative_offset);
+    mykafka::Error readAt(std::string& payload, int64_t relative_offset);
+
+    /*!
+    ** Read contiguous records, starting at the specified offset. Stop at
+    ** the end of the segment, at max_messages, or before exceeding
+    ** max_bytes. The first record is always returned, even if it is
+    ** bigger than max_bytes.
+    ** A sealed segment is read in place, from its mapping: data points
+    ** inside it, and stays valid until unpin (or close). Otherwise, the
+    ** log is read with a single positional read, and data points to
+    ** buffer.
+    **
+    ** @param buffer Where the log bytes are read, if not mapped.
+    ** @param data The raw log bytes (headers and payloads).
+    ** @param records The records found in data.
+    ** @param relative_offset The first offset to read.
+    ** @param max_bytes The max number of bytes to read.
+    ** @param max_messages The max number of records to read.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error readRange(std::vector<char>& buffer, const char*& data,
+                             std::vector<Record>& records, int64_t relative_offset,
+                             int64_t max_bytes, int64_t max_messages);
+
+    /*!
+    ** Seal the segment, once it's not the active one anymore.
+    ** Its index is shrunk and mapped read-only at its exact size,
+    ** and its log is mapped read-only.
+    ** With a cache, all its files are closed until the next pin.
+    ** Can run while the segment is read: waits for the readers
+    ** which pinned it unsealed.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error seal();
+
+    /*!
+    ** Flush the log to the disk (fdatasync). The index isn't: it
+    ** is checked against the log, and rebuilt if needed, on open.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error flush();
+
+    /*!
+    ** Flush the log of a segment not written anymore, through a
+    ** descriptor of its own: it can be sealed (and its files
+    ** released) by another thread meanwhile.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error syncLog() const;
+
+    /*!
+    ** Make sure the files of a sealed segment are open, and keep
+    ** them open until unpin. Must surround every read of a segment.
+    ** A segment not sealed yet stays so until unpin.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error pin();
+
+    /*!
+    ** Allow the cache to release the files again.
+    */
+    void unpin();
+
+    /*!
+    ** Close the files of a sealed segment, if it's not pinned.
+    ** Called by the cache.
+    **
+    ** @return True if the files have been released.
+    */
+    bool release();
 
     /*!
     ** Check if segment is full
@@ -109,7 +251,18 @@ namespace CommitLog
     mykafka::Error deleteSegment();
 
     /*!
-    ** Try to find an entry at a given offset (using a binary search).
+    ** Remove the files on destruction, instead of only closing
+    ** them. For a segment still used by readers.
+    */
+    void deleteOnDestroy();
+
+    /*!
+    ** Try to find an entry at a given offset.
+    ** As offsets are contiguous inside a segment, the index slot is
+    ** computed directly from the offset. If the entry found there
+    ** doesn't match, fall back on a binary search (see searchEntry).
+    ** With a sparse index, seek to the closest indexed entry before
+    ** the offset, then scan the log forward.
     ** If no offset is found, then rel_offset value will be -1.
     **
     ** @param rel_offset The offset of the entry.
@@ -121,6 +274,19 @@ namespace CommitLog
     mykafka::Error findEntry(int64_t& rel_offset, int64_t& rel_position,
                              int64_t search_offset) const;
 
+    /*!
+    ** Try to find an entry at a given offset, using a binary search.
+    ** If no offset is found, then rel_offset value will be -1.
+    **
+    ** @param rel_offset The offset of the entry.
+    ** @param rel_position The position of the entry.
+    ** @param search_offset The offset to search.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error searchEntry(int64_t& rel_offset, int64_t& rel_position,
+                               int64_t search_offset) const;
+
     /*!
     ** Get the file descriptor.
     **
@@ -165,6 +331,21 @@ namespace CommitLog
     */
     int64_t size() const;
 
+    /*!
+    ** Get the number of invalid bytes truncated at the end of
+    ** the log by the last open.
+    **
+    ** @return The number of truncated bytes.
+    */
+    int64_t truncatedBytes() const;
+
+    /*!
+    ** Check if the log is mapped (sealed, and pinned if using a cache).
+    **
+    ** @return True if reads are served from the mapping.
+    */
+    bool isMapped() const;
+
     /*!
     ** Get the last time the segment file has been modified.
     **
@@ -172,6 +353,116 @@ namespace CommitLog
     */
     int64_t mtime() const;
 
+  private:
+    /*!
+    ** Keep the index entries before the recovery point, then scan
+    ** the log after it. Fall back on reconstructIndexAndGetLastOffset
+    ** if the recovery point doesn't match the log.
+    **
+    ** @param recovery_offset The next offset at the recovery point.
+    ** @param recovery_position The log size at the recovery point.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error recoverFrom(int64_t recovery_offset, int64_t recovery_position);
+
+    /*!
+    ** Scan the log from a message boundary up to its end, and index
+    ** the messages found. Stop (and truncate) at the first invalid
+    ** or incomplete message.
+    **
+    ** @param relative_offset The offset of the first message to scan.
+    ** @param position The position of the first message to scan.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error scanLog(int64_t relative_offset, int64_t position);
+
+    /*!
+    ** Find an entry using the sparse index: start from the closest
+    ** indexed entry before the offset, and scan the log forward.
+    **
+    ** @param rel_offset The offset of the entry.
+    ** @param rel_position The position of the entry.
+    ** @param search_offset The offset to search.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error scanEntry(int64_t& rel_offset, int64_t& rel_position,
+                             int64_t search_offset) const;
+
+    /*!
+    ** Close the read-only log file and the index.
+    ** @warning Must be called with the resident lock held.
+    */
+    void closeResidentFiles();
+
+    /*!
+    ** Map the read-only log file, once sealed. Does nothing if
+    ** already mapped, or if the log is empty.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error mapLog();
+
+    /*!
+    ** Unmap the log file, if mapped.
+    */
+    void unmapLog();
+
+    /*!
+    ** Get the log bytes at a position, from the mapping, or
+    ** with a positional read into buffer.
+    **
+    ** @param buffer Where the bytes are read, if not mapped.
+    ** @param data The bytes.
+    ** @param position The position in the log.
+    ** @param bytes The number of bytes.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error readLog(std::vector<char>& buffer, const char*& data,
+                           int64_t position, int64_t bytes) const;
+
+    /*!
+    ** Parse the complete records in data, stopping at max_messages
+    ** or at the first incomplete one.
+    **
+    ** @param records The records found.
+    ** @param end The position after the last record found.
+    ** @param data The raw log bytes, starting at a record.
+    ** @param bytes The number of bytes in data.
+    ** @param first_offset The expected offset of the first record.
+    ** @param max_messages The max number of records.
+    ** @param rel_position The position of data in the log.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    mykafka::Error scanRecords(std::vector<Record>& records, int64_t& end,
+                               const char* data, int64_t bytes, int64_t first_offset,
+                               int64_t max_messages, int64_t rel_position) const;
+
+    /*!
+    ** Read the payload at an offset, in any container.
+    **
+    ** @param payload The payload.
+    ** @param relative_offset The offset to read.
+    **
+    ** @return Error code 0 if no error, or a detailed error.
+    */
+    template <typename T>
+    mykafka::Error readPayload(T& payload, int64_t relative_offset);
+
+    /*!
+    ** Check if a message written at the given position
+    ** needs an index entry.
+    **
+    ** @param position The position of the message in the log.
+    **
+    ** @return True if an entry is needed.
+    */
+    bool needIndexEntry(int64_t position) const;
+
   private:
     struct Entry
     {
@@ -182,13 +473,26 @@ namespace CommitLog
   private:
     int fd_;
     int fd_read_;
+    void* log_addr_;
+    int64_t log_mapped_size_;
     int64_t next_offset_;
     int64_t position_;
     int64_t physical_size_;
     int64_t mtime_;
+    int64_t truncated_bytes_;
     const int64_t max_size_;
+    const int64_t index_interval_bytes_;
+    int64_t last_index_position_;
+    const std::string path_;
     std::string filename_;
     Index index_;
+    SegmentCache* cache_;
+    std::atomic<bool> sealed_;
+    bool delete_on_destroy_;
+    bool resident_;
+    int32_t pins_;
+    boost::mutex resident_mutex_;
+    boost::shared_mutex seal_mutex_; // Shared by the readers of an unsealed segment
   };
 } // CommitLog
 
@@ -0,0 +1,59 @@
+#include "commitlog/SegmentCache.hh"
+#include "commitlog/Segment.hh"
+
+namespace CommitLog
+{
+  SegmentCache::SegmentCache(int64_t max_open_segments)
+    : max_open_segments_(max_open_segments), lru_(), entries_()
+  {
+  }
+
+  void
+  SegmentCache::touch(Segment* segment)
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    auto found = entries_.find(segment);
+    if (found != entries_.end())
+      lru_.splice(lru_.begin(), lru_, found->second);
+    else
+      entries_[segment] = lru_.insert(lru_.begin(), segment);
+
+    // Segments being read are skipped, they will be released later.
+    auto it = lru_.end();
+    while (static_cast<int64_t>(lru_.size()) > max_open_segments_ && it != lru_.begin())
+    {
+      --it;
+      if (*it != segment && (*it)->release())
+      {
+        entries_.erase(*it);
+        it = lru_.erase(it);
+      }
+    }
+  }
+
+  void
+  SegmentCache::remove(Segment* segment)
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    auto found = entries_.find(segment);
+    if (found == entries_.end())
+      return;
+    lru_.erase(found->second);
+    entries_.erase(found);
+  }
+
+  int64_t
+  SegmentCache::size() const
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return lru_.size();
+  }
+
+  int64_t
+  SegmentCache::maxOpenSegments() const
+  {
+    return max_open_segments_;
+  }
+} // CommitLog
@@ -0,0 +1,78 @@
+#ifndef COMMIT_LOG_SEGMENTCACHE_HH_
+# define COMMIT_LOG_SEGMENTCACHE_HH_
+
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/locks.hpp>
+# include <inttypes.h>
+# include <list>
+# include <unordered_map>
+
+namespace CommitLog
+{
+  class Segment;
+
+  /*!
+  ** @class SegmentCache
+  **
+  ** LRU list of the sealed segments having their files open
+  ** (log file descriptor, index file descriptor and mapping).
+  ** Shared by all the partitions of a broker.
+  **
+  ** A sealed segment releases its files, and reopens them when
+  ** it is read. Once more than max_open_segments sealed segments
+  ** are open, the least recently read ones (not being read) are
+  ** released. The active segments are never in the cache.
+  */
+  class SegmentCache
+  {
+  public:
+    /*!
+    ** Initialize a new cache.
+    **
+    ** @param max_open_segments Max number of sealed segments
+    **          keeping their files open.
+    */
+    SegmentCache(int64_t max_open_segments);
+
+    /*!
+    ** Mark a segment as the most recently used, then release
+    ** the least recently used ones if over the budget.
+    ** @warning The segment lock must not be held.
+    **
+    ** @param segment The segment just read.
+    */
+    void touch(Segment* segment);
+
+    /*!
+    ** Forget a segment (closed or deleted).
+    **
+    ** @param segment The segment.
+    */
+    void remove(Segment* segment);
+
+    /*!
+    ** Get the number of sealed segments having their files open.
+    **
+    ** @return The number of open segments.
+    */
+    int64_t size() const;
+
+    /*!
+    ** Get the max number of sealed segments having their files open.
+    **
+    ** @return The max number of open segments.
+    */
+    int64_t maxOpenSegments() const;
+
+  private:
+    typedef std::list<Segment*> lru_type;
+
+  private:
+    const int64_t max_open_segments_;
+    lru_type lru_;
+    std::unordered_map<Segment*, lru_type::iterator> entries_;
+    mutable boost::mutex mutex_;
+  };
+} // CommitLog
+
+#endif /* !COMMIT_LOG_SEGMENTCACHE_HH_ */
@@ -7,8 +7,13 @@
 #include "utils/Utils.hh"
 #include "boost_test_helper.hh"
 
+#include <linux/limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <inttypes.h>
 #include <array>
+#include <functional>
 
 namespace
 {
@@ -37,10 +42,10 @@ namespace
     };
   const int64_t size = payloadsSize(payloads);
 
-  void testSegment(int64_t base_offset, bool reopen = false)
+  void testSegment(int64_t base_offset, bool reopen = false, int64_t index_interval = 0)
   {
     const int64_t size = payloadsSize(payloads);
-    CommitLog::Segment segment(tmp_path, base_offset, size);
+    CommitLog::Segment segment(tmp_path, base_offset, size, index_interval);
     segment.deleteSegment();
 
     auto res = segment.open();
@@ -103,6 +108,227 @@ namespace
     BOOST_CHECK_EQUAL_MSG(segment.indexFd(), -1,
                           "After a close, index fd should be at -1");
   }
+
+  void testSegmentBatch(int64_t base_offset, int64_t nb_batch)
+  {
+    CommitLog::Segment segment(tmp_path, base_offset, size * nb_batch);
+    segment.deleteSegment();
+
+    auto res = segment.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+    std::vector<std::vector<char> > batch;
+    for (int64_t i = 0; i < nb_batch; ++i)
+      for (auto& payload : payloads)
+        batch.emplace_back(payload.begin(), payload.end());
+
+    int64_t first_offset = -1;
+    res = segment.writeBatch(batch, first_offset);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(first_offset, base_offset);
+    BOOST_CHECK_EQUAL(segment.nextOffset(), base_offset + static_cast<int64_t>(batch.size()));
+
+    struct stat buf;
+    fstat(segment.segmentFd(), &buf);
+    BOOST_CHECK_EQUAL(size * nb_batch, buf.st_size);
+    BOOST_CHECK_EQUAL(size * nb_batch, segment.size());
+
+    // Single writes must follow the batch seamlessly.
+    int64_t written_offset = -1;
+    res = segment.write(batch[0], written_offset);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(written_offset, base_offset + static_cast<int64_t>(batch.size()));
+
+    res = segment.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    res = segment.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(segment.nextOffset(), base_offset + static_cast<int64_t>(batch.size()) + 1);
+
+    std::vector<char> raw_got_payload;
+    for (int64_t offset = 0; offset < static_cast<int64_t>(batch.size()); ++offset)
+    {
+      res = segment.readAt(raw_got_payload, offset);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      BOOST_CHECK(batch[offset] == raw_got_payload);
+    }
+
+    res = segment.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+
+  void testSegmentRange(int64_t base_offset, int64_t index_interval = 0)
+  {
+    CommitLog::Segment segment(tmp_path, base_offset, size, index_interval);
+    segment.deleteSegment();
+
+    auto res = segment.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+    for (auto& payload : payloads)
+    {
+      int64_t written_offset = 0;
+      const std::vector<char> v_payload(payload.begin(), payload.end());
+      res = segment.write(v_payload, written_offset);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    }
+
+    std::vector<char> buffer;
+    const char* data = 0;
+    std::vector<CommitLog::Segment::Record> records;
+    auto checkRecords = [&](int64_t first, int64_t nb) {
+      BOOST_CHECK_EQUAL(static_cast<int64_t>(records.size()), nb);
+      for (int64_t i = 0; i < static_cast<int64_t>(records.size()); ++i)
+      {
+        const std::string got(data + records[i].position, records[i].size);
+        BOOST_CHECK_EQUAL(records[i].offset, base_offset + first + i);
+        BOOST_CHECK_EQUAL(got, payloads[first + i]);
+      }
+    };
+
+    const int64_t two_records = payloadsSize(std::vector<std::string>(payloads.begin() + 4,
+                                                                      payloads.begin() + 6));
+    auto checkRanges = [&]() {
+      // Everything
+      res = segment.readRange(buffer, data, records, 0, size * 2, 100);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      checkRecords(0, payloads.size());
+
+      // Bounded by max_messages
+      res = segment.readRange(buffer, data, records, 2, size, 3);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      checkRecords(2, 3);
+
+      // Bounded by max_bytes, partial records are dropped
+      res = segment.readRange(buffer, data, records, 4, two_records + 5, 100);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      checkRecords(4, 2);
+
+      // The first record is always returned
+      res = segment.readRange(buffer, data, records, 8, 1, 100);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      checkRecords(8, 1);
+
+      // Past the end
+      res = segment.readRange(buffer, data, records, payloads.size(), size, 100);
+      BOOST_CHECK_NE(res.code(), mykafka::Error::OK);
+    };
+
+    // Active segment: read into the buffer.
+    checkRanges();
+    BOOST_CHECK(!segment.isMapped());
+
+    // Sealed segment: read in place, from the mapping.
+    res = segment.seal();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK(segment.isMapped());
+    buffer.clear();
+    checkRanges();
+    BOOST_CHECK(buffer.empty());
+
+    std::string payload;
+    res = segment.readAt(payload, 3);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(payload, payloads[3]);
+
+    res = segment.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+  std::string segmentFilename(int64_t base_offset, const char* extension)
+  {
+    char buffer[PATH_MAX] = {0};
+    sprintf(buffer, "%s/%020" PRId64 ".%s", tmp_path.c_str(), base_offset, extension);
+    return std::string(buffer);
+  }
+
+  // Damage the files of a closed segment, reopen it, and check every
+  // message is still there and the segment is still writable.
+  void testSegmentRecovery(int64_t base_offset, int64_t index_interval,
+                           const std::function<void()>& damage, int64_t truncated = 0)
+  {
+    CommitLog::Segment segment(tmp_path, base_offset, size * 2, index_interval);
+    segment.deleteSegment();
+
+    auto res = segment.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    for (auto& payload : payloads)
+    {
+      int64_t written_offset = 0;
+      const std::vector<char> v_payload(payload.begin(), payload.end());
+      res = segment.write(v_payload, written_offset);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    }
+    res = segment.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+
+    damage();
+
+    res = segment.open();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(segment.nextOffset(), base_offset + static_cast<int64_t>(payloads.size()));
+    BOOST_CHECK_EQUAL(segment.size(), size);
+    BOOST_CHECK_EQUAL(segment.truncatedBytes(), truncated);
+
+    int64_t written_offset = 0;
+    const std::vector<char> v_payload(payloads[0].begin(), payloads[0].end());
+    res = segment.write(v_payload, written_offset);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+    BOOST_CHECK_EQUAL(written_offset, base_offset + static_cast<int64_t>(payloads.size()));
+
+    std::vector<char> raw_got_payload;
+    for (int64_t offset = 0; offset <= static_cast<int64_t>(payloads.size()); ++offset)
+    {
+      res = segment.readAt(raw_got_payload, offset);
+      BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+      const std::string got_payload(raw_got_payload.begin(), raw_got_payload.end());
+      BOOST_CHECK_EQUAL(payloads[offset % payloads.size()], got_payload);
+    }
+
+    res = segment.close();
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+
+  void testSegmentRecoveries(int64_t base_offset, int64_t index_interval)
+  {
+    const std::string index_filename = segmentFilename(base_offset, "index");
+    const std::string log_filename = segmentFilename(base_offset, "log");
+
+    // Index left at its preallocated size by a crash
+    testSegmentRecovery(base_offset, index_interval, [&]() {
+        BOOST_CHECK_EQUAL(truncate(index_filename.c_str(), 4096), 0);
+      });
+
+    // Index missing its last entries
+    testSegmentRecovery(base_offset, index_interval, [&]() {
+        struct stat buf;
+        BOOST_CHECK_EQUAL(stat(index_filename.c_str(), &buf), 0);
+        BOOST_CHECK_EQUAL(truncate(index_filename.c_str(),
+                                   std::max<int64_t>(0, buf.st_size - 16)), 0);
+      });
+
+    // Last index entry pointing to garbage
+    testSegmentRecovery(base_offset, index_interval, [&]() {
+        struct stat buf;
+        BOOST_CHECK_EQUAL(stat(index_filename.c_str(), &buf), 0);
+        const int32_t garbage[2] = {1000, 12345};
+        const int fd = ::open(index_filename.c_str(), O_WRONLY);
+        BOOST_CHECK_EQUAL(pwrite(fd, garbage, sizeof (garbage), buf.st_size - 8), 8);
+        ::close(fd);
+      });
+
+    // Message partially written at the end of the log
+    testSegmentRecovery(base_offset, index_interval, [&]() {
+        const int fd = ::open(log_filename.c_str(), O_WRONLY | O_APPEND);
+        const char torn[] = "\x42\x00\x00\x00\x00\x00\x00\x00\x20\x00\x00\x00{my_pay";
+        BOOST_CHECK_EQUAL(write(fd, torn, sizeof (torn) - 1), static_cast<ssize_t>(sizeof (torn) - 1));
+        ::close(fd);
+      }, CommitLog::Segment::HEADER_SIZE + 7);
+
+    // Index lost
+    testSegmentRecovery(base_offset, index_interval, [&]() {
+        BOOST_CHECK_EQUAL(unlink(index_filename.c_str()), 0);
+      });
+  }
 } // namespace
 
 
@@ -145,3 +371,54 @@ BOOST_AUTO_TEST_CASE(test_segment_big_offset_reopen)
 {
   testSegment(520053, true);
 }
+
+BOOST_AUTO_TEST_CASE(test_segment_batch_offset_0)
+{
+  testSegmentBatch(0, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_batch_big_offset)
+{
+  testSegmentBatch(520053, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_batch_above_iov_max)
+{
+  testSegmentBatch(1024, 300); // 3000 payloads, 6000 iovec
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_range_offset_0)
+{
+  testSegmentRange(0);
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_range_big_offset)
+{
+  testSegmentRange(520053);
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_sparse_index)
+{
+  testSegment(0, false, 100);
+  testSegment(1024, true, 100);
+  testSegment(520053, true, 1); // Every message gets an entry
+  testSegment(0, true, 1024 * 1024); // Only the first message gets an entry
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_sparse_range)
+{
+  testSegmentRange(0, 100);
+  testSegmentRange(520053, 1024 * 1024);
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_recovery)
+{
+  testSegmentRecoveries(0, 0);
+  testSegmentRecoveries(520053, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_segment_sparse_recovery)
+{
+  testSegmentRecoveries(0, 100);
+  testSegmentRecoveries(1024, 1024 * 1024);
+}
@@ -14,9 +14,13 @@ namespace po = boost::program_options;
 int main(int argc, char** argv)
 {
   bool stop_no_msg;
+  bool subscribe;
   int32_t partition;
   int64_t offset;
   int64_t nb_offset;
+  int64_t max_bytes;
+  int64_t max_messages;
+  int32_t max_wait_ms;
   std::string address;
   std::string topic;
 
@@ -30,7 +34,15 @@ int main(int argc, char** argv)
     ("nb-offset", po::value<int64_t>(&nb_offset)->default_value(0),
      "Set the max number of offset to read (0 = no limit)")
     ("partition", po::value<int32_t>(&partition)->default_value(0), "Set the partition")
+    ("max-bytes", po::value<int64_t>(&max_bytes)->default_value(1024 * 1024),
+     "Set the max number of bytes fetched per request")
+    ("max-messages", po::value<int64_t>(&max_messages)->default_value(0),
+     "Set the max number of messages fetched per request (0 = no limit)")
+    ("max-wait-ms", po::value<int32_t>(&max_wait_ms)->default_value(5000),
+     "Set the max time the broker waits for new messages (0 = poll every 2 sec)")
     ("stop-if-no-message", po::value<bool>(&stop_no_msg)->default_value(false), "Stop if no message left")
+    ("subscribe", po::value<bool>(&subscribe)->default_value(false),
+     "Receive the messages as they are written, on one stream (ignores stop-if-no-message)")
     ;
 
   po::variables_map vm;
@@ -66,34 +78,70 @@ int main(int argc, char** argv)
 
   std::cout << "Start to receive from " << address << std::endl;
 
+  if (subscribe)
+  {
+    mykafka::SubscribeRequest request;
+    request.set_topic(topic);
+    request.set_partition(partition);
+    request.set_start_offset(offset);
+    request.set_max_batch_bytes(max_bytes);
+    auto res = client.subscribe(request, [&](const mykafka::GetMessagesResponse& response) {
+        for (auto& record : response.records())
+          std::cout << "Payload at offset " << record.offset() << ": " << record.payload() << std::endl;
+        offset += response.records_size();
+        if (response.error().code() != mykafka::Error::OK)
+        {
+          std::cout << response.error().code() << ": "
+                    << response.error().msg() << std::endl;
+          return false;
+        }
+        return !(nb_offset > 0 && offset >= nb_offset);
+      });
+    if (!res.ok() && res.error_code() != grpc::StatusCode::CANCELLED)
+      std::cout << res.error_code() << ": " << res.error_message() << std::endl;
+    return 0;
+  }
+
   bool stop = false;
   while (!stop)
   {
-    mykafka::GetMessageRequest request;
-    mykafka::GetMessageResponse response;
+    mykafka::GetMessagesRequest request;
+    mykafka::GetMessagesResponse response;
     request.set_topic(topic);
     request.set_partition(partition);
     request.set_offset(offset);
-    auto res = client.getMessage(request, response, true);
+    request.set_max_bytes(max_bytes);
+    request.set_max_messages(max_messages);
+    if (!stop_no_msg)
+      request.set_max_wait_ms(max_wait_ms);
+    if (nb_offset > 0 && (max_messages <= 0 || nb_offset - offset < max_messages))
+      request.set_max_messages(nb_offset - offset);
+    auto res = client.getMessages(request, response, true);
     if (res.ok())
-      std::cout << "Payload at offset " << offset << ": " << response.payload() << std::endl;
+    {
+      for (auto& record : response.records())
+        std::cout << "Payload at offset " << record.offset() << ": " << record.payload() << std::endl;
+    }
     else
+    {
       std::cout << res.error_code() << ": " << res.error_message() << std::endl;
+      break;
+    }
 
     switch (response.error().code())
     {
       case mykafka::Error::OK:
-        ++offset;
+        offset += response.records_size();
         break;
       case mykafka::Error::NO_MESSAGE:
         {
-          if (!stop_no_msg)
+          if (stop_no_msg)
+            stop = true;
+          else if (max_wait_ms <= 0)
           {
             std::cout << "No message to fetch, waiting 2 sec..." << std::endl;
             std::this_thread::sleep_for(std::chrono::milliseconds(2000));
           }
-          else
-            stop = true;
         }
         break;
       default:
@@ -16,6 +16,9 @@ int main(int argc, char** argv)
   int64_t max_segment_size;
   int64_t max_partition_size;
   int64_t segment_ttl;
+  int64_t index_interval;
+  int64_t flush_messages;
+  int64_t flush_ms;
   std::string address;
   std::string topic;
   std::string action;
@@ -34,6 +37,13 @@ int main(int argc, char** argv)
      "Set the partition max size (0 = no max limit). Older segment will be destroy.")
     ("segment-ttl", po::value<int64_t>(&segment_ttl)->default_value(0),
      "Set the segment ttl in seconds (0 = no ttl). Segment older than ttl will be destroy.")
+    ("index-interval", po::value<int64_t>(&index_interval)->default_value(0),
+     "Set the bytes of log between two index entries (0 = one entry per message).")
+    ("flush-messages", po::value<int64_t>(&flush_messages)->default_value(0),
+     "Flush the log every N messages, before acknowledging them"
+     " (0 = disabled, 1 = every request).")
+    ("flush-ms", po::value<int64_t>(&flush_ms)->default_value(0),
+     "Flush the log every N ms, in background (0 = disabled).")
     ;
 
   po::variables_map vm;
@@ -59,6 +69,9 @@ int main(int argc, char** argv)
     request.set_max_segment_size(max_segment_size);
     request.set_max_partition_size(max_partition_size);
     request.set_segment_ttl(segment_ttl);
+    request.set_index_interval_bytes(index_interval);
+    request.set_flush_messages(flush_messages);
+    request.set_flush_ms(flush_ms);
     auto res = client.createPartition(request, response);
     CHECK_ERROR("create partition", response.code(), response.msg());
 
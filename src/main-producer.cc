@@ -15,6 +15,8 @@ int main(int argc, char** argv)
   std::string address;
   std::string topic;
   int32_t partition;
+  int64_t window;
+  int32_t batch_size;
 
   po::options_description desc("Kafka producer");
   desc.add_options()
@@ -23,6 +25,10 @@ int main(int argc, char** argv)
      po::value<std::string>(&address)->default_value("localhost:9000"), "Set the broker address")
     ("topic", po::value<std::string>(&topic)->default_value("default"), "Set the topic")
     ("partition", po::value<int32_t>(&partition)->default_value(0), "Set the partition")
+    ("window", po::value<int64_t>(&window)->default_value(1000),
+     "Set the max number of messages sent and not acknowledged yet")
+    ("batch-size", po::value<int32_t>(&batch_size)->default_value(1),
+     "Set the number of lines sent in one batch")
     ;
 
   po::variables_map vm;
@@ -41,25 +47,25 @@ int main(int argc, char** argv)
 
   Network::Client client(address);
   std::cout << "Start to send to " << address << std::endl;
-  std::string line;
-  while (std::getline(std::cin, line))
-  {
-      mykafka::SendMessageRequest request;
-      mykafka::SendMessageResponse response;
-      request.set_topic(topic);
-      request.set_partition(partition);
-      request.set_payload(line);
-      auto res = client.sendMessage(request, response, true);
-      if (!res.ok())
-        std::cout << res.error_code() << ": " << res.error_message() << std::endl;
+  auto res = client.produce(window, [&](mykafka::MessageBatch& batch) {
+      batch.set_topic(topic);
+      batch.set_partition(partition);
+      std::string line;
+      while (batch.payloads_size() < batch_size && std::getline(std::cin, line))
+        batch.add_payloads(line);
+      return batch.payloads_size() > 0;
+    },
+    [](const mykafka::MessageBatchResult& result) {
+      if (result.error().code() != mykafka::Error::OK)
+        std::cout << result.error().code() << ": " << result.error().msg() << std::endl;
+      else if (result.base_offset() == result.last_offset())
+        std::cout << "Payload written at offset " << result.base_offset() << std::endl;
       else
-      {
-        if (response.error().code() == mykafka::Error::OK)
-          std::cout << "Payload written at offset " << response.offset() << std::endl;
-        else
-          std::cout << response.error().code() << ": " << response.error().msg() << std::endl;
-      }
-  }
+        std::cout << "Payloads written at offsets " << result.base_offset()
+                  << "-" << result.last_offset() << std::endl;
+    });
+  if (!res.ok())
+    std::cout << res.error_code() << ": " << res.error_message() << std::endl;
 
   return 0;
 }
@@ -4,14 +4,110 @@
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <functional>
+#include <pthread.h>
+#include <signal.h>
+#include <thread>
+#include <vector>
 
 namespace po = boost::program_options;
 
+namespace
+{
+  /*!
+  ** @class BackgroundTasks
+  **
+  ** Run broker actions periodically, one thread per action,
+  ** until stopped.
+  */
+  class BackgroundTasks
+  {
+  public:
+    BackgroundTasks()
+      : stop_(false)
+    {
+    }
+
+    ~BackgroundTasks()
+    {
+      stop();
+    }
+
+    /*!
+    ** Run an action every interval, printing its errors.
+    **
+    ** @param interval_ms The interval (ms).
+    ** @param label The action name, for the errors.
+    ** @param action The action.
+    */
+    void every(int64_t interval_ms, const std::string& label,
+               const std::function<mykafka::Error()>& action)
+    {
+      threads_.emplace_back([this, interval_ms, label, action]()
+                            {
+                              while (!waitStop(interval_ms))
+                              {
+                                auto res = action();
+                                if (res.code() != mykafka::Error::OK)
+                                  std::cout << "Can't " << label << ", error is: ["
+                                            << res.code() << "] " << res.msg() << std::endl;
+                              }
+                            });
+    }
+
+    /*!
+    ** Stop the actions (an action in progress is completed),
+    ** and join their threads.
+    */
+    void stop()
+    {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      stopped_.notify_all();
+      for (auto& thread : threads_)
+        thread.join();
+      threads_.clear();
+    }
+
+  private:
+    /*!
+    ** Wait for an interval, or less if stopped.
+    **
+    ** @param interval_ms The interval (ms).
+    **
+    ** @return True if stopped.
+    */
+    bool waitStop(int64_t interval_ms)
+    {
+      boost::unique_lock<boost::mutex> lock(mutex_);
+      return stopped_.wait_for(lock, boost::chrono::milliseconds(interval_ms),
+                               [this]() { return stop_; });
+    }
+
+  private:
+    bool stop_;
+    boost::mutex mutex_;
+    boost::condition_variable stopped_;
+    std::vector<std::thread> threads_;
+  };
+} // namespace
+
 int main(int argc, char** argv)
 {
   int32_t nb_threads;
   int32_t port;
   int32_t broker_id;
+  int32_t checkpoint_interval;
+  int64_t max_open_segments;
+  int32_t nb_writers;
+  int32_t flush_tick_ms;
+  int32_t prepare_tick_ms;
+  int32_t retention_check_interval;
+  int64_t retention_max_bytes_per_sec;
   std::string log_dir;
 
   po::options_description desc("Kafka broker");
@@ -22,6 +118,24 @@ int main(int argc, char** argv)
     ("port", po::value<int32_t>(&port)->default_value(9000), "Set the port")
     ("broker-id", po::value<int32_t>(&broker_id)->default_value(0), "Set the broker-id")
     ("log-dir", po::value<std::string>(&log_dir)->default_value("/tmp/myKafka"), "Set the log directory")
+    ("checkpoint-interval", po::value<int32_t>(&checkpoint_interval)->default_value(60),
+     "Save the recovery points every N seconds (0 = only on shutdown)")
+    ("max-open-segments", po::value<int64_t>(&max_open_segments)->default_value(1000),
+     "Max number of sealed segments keeping their files open (0 = no limit)")
+    ("nb-writers", po::value<int32_t>(&nb_writers)->default_value(0),
+     "Set the number of writer threads, each owning a shard of the partitions"
+     " (0 = use the core number)")
+    ("flush-tick-ms", po::value<int32_t>(&flush_tick_ms)->default_value(10),
+     "Check the partitions flush_ms policy every N ms (0 = never)")
+    ("prepare-tick-ms", po::value<int32_t>(&prepare_tick_ms)->default_value(100),
+     "Open the next segment of the partitions ahead, every N ms"
+     " (0 = open it when rolling)")
+    ("retention-check-interval", po::value<int32_t>(&retention_check_interval)->default_value(30),
+     "Delete the segments out of retention (ttl, partition size) every N seconds"
+     " (0 = only on load)")
+    ("retention-max-bytes-per-sec",
+     po::value<int64_t>(&retention_max_bytes_per_sec)->default_value(0),
+     "Limit the rate of segment deletions (0 = no limit)")
     ;
 
   po::variables_map vm;
@@ -40,7 +154,15 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  Broker::Broker broker(log_dir);
+  // SIGINT/SIGTERM are blocked in every thread (the mask is inherited),
+  // and waited by the shutdown thread: a clean shutdown closes the broker.
+  sigset_t signals;
+  ::sigemptyset(&signals);
+  ::sigaddset(&signals, SIGINT);
+  ::sigaddset(&signals, SIGTERM);
+  ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  Broker::Broker broker(log_dir, max_open_segments, nb_writers);
   auto res = broker.load();
   if (res.code() != mykafka::Error::OK)
   {
@@ -50,8 +172,51 @@ int main(int argc, char** argv)
     return 1;
   }
 
+  BackgroundTasks tasks;
+  // After a crash, only what was written since the last checkpoint is checked.
+  if (checkpoint_interval > 0)
+    tasks.every(checkpoint_interval * 1000, "checkpoint",
+                [&broker]() { return broker.checkpoint(); });
+
+  // Flushes behind the acknowledgements, for partitions with a flush_ms policy.
+  if (flush_tick_ms > 0)
+    tasks.every(flush_tick_ms, "flush", [&broker]() { return broker.flush(); });
+
+  // Rolls only have to rename a segment opened ahead.
+  if (prepare_tick_ms > 0)
+    tasks.every(prepare_tick_ms, "prepare segments",
+                [&broker]() { return broker.prepareSegments(); });
+
+  // Retention janitor: producers never wait for deletions.
+  if (retention_check_interval > 0)
+    tasks.every(retention_check_interval * 1000, "clean old segments",
+                [&broker, retention_max_bytes_per_sec]()
+                {
+                  return broker.cleanOldSegments(retention_max_bytes_per_sec);
+                });
+
   Network::BrokerServer server("0.0.0.0:" + std::to_string(port), broker, nb_threads);
+  std::thread shutdown_thread([&signals, &server]()
+                              {
+                                int sig = 0;
+                                ::sigwait(&signals, &sig);
+                                std::cout << "Shutting down" << std::endl;
+                                server.shutdown();
+                              });
   server.run();
 
+  // Also wakes up the shutdown thread if the server stopped by itself.
+  ::pthread_kill(shutdown_thread.native_handle(), SIGTERM);
+  shutdown_thread.join();
+  tasks.stop();
+
+  res = broker.close();
+  if (res.code() != mykafka::Error::OK)
+  {
+    std::cout << "Can't close the broker, error is: [" << res.code() << "] "
+              << res.msg() << std::endl;
+    return 1;
+  }
+
   return 0;
 }
@@ -1,7 +1,11 @@
 #include "network/BrokerServer.hh"
 #include "network/SendMessageService.hh"
+#include "network/SendMessagesService.hh"
 #include "network/GetMessageService.hh"
+#include "network/GetMessagesService.hh"
 #include "network/GetOffsetsService.hh"
+#include "network/SubscribeService.hh"
+#include "network/ProduceService.hh"
 #include "network/BrokerInfoService.hh"
 #include "network/CreatePartitionService.hh"
 #include "network/DeletePartitionService.hh"
@@ -27,8 +31,12 @@ namespace Network
   BrokerServer::specificHandle()
   {
     new SendMessageService(broker_, service_, cq_.get());
+    new SendMessagesService(broker_, service_, cq_.get());
     new GetMessageService(broker_, service_, cq_.get());
+    new GetMessagesService(broker_, service_, cq_.get());
     new GetOffsetsService(broker_, service_, cq_.get());
+    new SubscribeService(broker_, service_, cq_.get());
+    new ProduceService(broker_, service_, cq_.get());
     new BrokerInfoService(broker_, service_, cq_.get());
     new CreatePartitionService(broker_, service_, cq_.get());
     new DeletePartitionService(broker_, service_, cq_.get());
@@ -1,13 +1,15 @@
 #include "network/Client.hh"
 
 #include <chrono>
+#include <deque>
 
-#define METHOD_IMPL(SERVICE)                                            \
+// WAIT_MS: time the server may park the call, added to the deadline.
+#define METHOD_IMPL_WAIT(SERVICE, WAIT_MS)                              \
   do {                                                                  \
     grpc::ClientContext context;                                        \
     if (client_connection_timeout_ > 0)                                 \
       context.set_deadline(std::chrono::system_clock::now() +           \
-                           std::chrono::milliseconds(client_connection_timeout_)); \
+                           std::chrono::milliseconds(client_connection_timeout_ + (WAIT_MS))); \
                                                                         \
     grpc::Status status = stub_->SERVICE(&context, request, &response); \
     while (try_reconnect && !status.ok())                               \
@@ -18,22 +20,31 @@
       grpc::ClientContext context;                                      \
       if (client_connection_timeout_ > 0)                               \
         context.set_deadline(std::chrono::system_clock::now() +         \
-                             std::chrono::milliseconds(client_connection_timeout_)); \
+                             std::chrono::milliseconds(client_connection_timeout_ + (WAIT_MS))); \
       status = stub_->SERVICE(&context, request, &response);            \
     }                                                                   \
                                                                         \
     return status;                                                      \
   } while (0)
 
+#define METHOD_IMPL(SERVICE) METHOD_IMPL_WAIT(SERVICE, 0)
+
 
 namespace Network
 {
-  Client::Client(std::string address, int64_t client_connection_timeout)
+  Client::Client(std::string address, int64_t client_connection_timeout,
+                 int64_t max_in_flight)
     : address_(address),
       client_connection_timeout_(client_connection_timeout),
       reconnect_timeout_(30 * 1000 /* 30 sec */),
       channel_(),
-      stub_()
+      stub_(),
+      max_in_flight_(max_in_flight > 0 ? max_in_flight : 1),
+      in_flight_(0),
+      cq_(),
+      poller_(),
+      async_mutex_(),
+      slot_freed_()
   {
     grpc::ChannelArguments args;
     args.SetInt(GRPC_ARG_MAX_RECONNECT_BACKOFF_MS, 1000);
@@ -41,6 +52,15 @@ namespace Network
     stub_ = mykafka::Broker::NewStub(channel_);
   }
 
+  Client::~Client()
+  {
+    // Pending calls still complete (or reach their deadline) before
+    // the polling thread sees the shutdown.
+    cq_.Shutdown();
+    if (poller_.joinable())
+      poller_.join();
+  }
+
   bool
   Client::reconnect()
   {
@@ -56,12 +76,28 @@ namespace Network
     METHOD_IMPL(SendMessage);
   }
 
+  grpc::Status
+  Client::sendMessages(mykafka::SendMessagesRequest& request,
+                       mykafka::SendMessagesResponse& response,
+                       bool try_reconnect)
+  {
+    METHOD_IMPL(SendMessages);
+  }
+
   grpc::Status
   Client::getMessage(mykafka::GetMessageRequest& request,
                      mykafka::GetMessageResponse& response,
                      bool try_reconnect)
   {
-    METHOD_IMPL(GetMessage);
+    METHOD_IMPL_WAIT(GetMessage, request.max_wait_ms());
+  }
+
+  grpc::Status
+  Client::getMessages(mykafka::GetMessagesRequest& request,
+                      mykafka::GetMessagesResponse& response,
+                      bool try_reconnect)
+  {
+    METHOD_IMPL_WAIT(GetMessages, request.max_wait_ms());
   }
 
   grpc::Status
@@ -96,6 +132,141 @@ namespace Network
     METHOD_IMPL(GetOffsets);
   }
 
+  grpc::Status
+  Client::subscribe(mykafka::SubscribeRequest& request,
+                    const std::function<bool(const mykafka::GetMessagesResponse&)>& callback)
+  {
+    grpc::ClientContext context;
+    auto reader = stub_->Subscribe(&context, request);
+
+    mykafka::GetMessagesResponse response;
+    while (reader->Read(&response))
+    {
+      if (!callback(response))
+      {
+        context.TryCancel();
+        break;
+      }
+    }
+
+    return reader->Finish();
+  }
+
+  void
+  Client::sendMessageAsync(const mykafka::SendMessageRequest& request,
+                           const std::function<void(const grpc::Status&,
+                                                    const mykafka::SendMessageResponse&)>& callback)
+  {
+    auto call = new AsyncResponseCall<mykafka::SendMessageResponse>(callback);
+    startCall(call);
+    call->reader = stub_->AsyncSendMessage(&call->context, request, &cq_);
+    call->reader->Finish(&call->response, &call->status, call);
+  }
+
+  void
+  Client::sendMessagesAsync(const mykafka::SendMessagesRequest& request,
+                            const std::function<void(const grpc::Status&,
+                                                     const mykafka::SendMessagesResponse&)>& callback)
+  {
+    auto call = new AsyncResponseCall<mykafka::SendMessagesResponse>(callback);
+    startCall(call);
+    call->reader = stub_->AsyncSendMessages(&call->context, request, &cq_);
+    call->reader->Finish(&call->response, &call->status, call);
+  }
+
+  int64_t
+  Client::inFlight() const
+  {
+    boost::lock_guard<boost::mutex> lock(async_mutex_);
+    return in_flight_;
+  }
+
+  void
+  Client::startCall(AsyncCall* call)
+  {
+    {
+      boost::unique_lock<boost::mutex> lock(async_mutex_);
+      while (in_flight_ >= max_in_flight_)
+        slot_freed_.wait(lock);
+      ++in_flight_;
+      if (!poller_.joinable())
+        poller_ = std::thread(&Client::poll, this);
+    }
+
+    if (client_connection_timeout_ > 0)
+      call->context.set_deadline(std::chrono::system_clock::now() +
+                                 std::chrono::milliseconds(client_connection_timeout_));
+  }
+
+  void
+  Client::poll()
+  {
+    void* tag = nullptr;
+    bool ok = false;
+    while (cq_.Next(&tag, &ok))
+    {
+      std::unique_ptr<AsyncCall> call(static_cast<AsyncCall*>(tag));
+      call->done();
+      {
+        boost::lock_guard<boost::mutex> lock(async_mutex_);
+        --in_flight_;
+      }
+      slot_freed_.notify_one();
+    }
+  }
+
+  grpc::Status
+  Client::produce(int64_t window,
+                  const std::function<bool(mykafka::MessageBatch&)>& next,
+                  const std::function<void(const mykafka::MessageBatchResult&)>& on_ack)
+  {
+    grpc::ClientContext context;
+    auto stream = stub_->Produce(&context);
+
+    boost::mutex mutex;
+    boost::condition_variable acked;
+    std::deque<int64_t> in_flight_batches;
+    int64_t in_flight = 0;
+
+    std::thread reader([&]() {
+        mykafka::MessageBatchResult result;
+        while (stream->Read(&result))
+        {
+          {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            in_flight -= in_flight_batches.front();
+            in_flight_batches.pop_front();
+          }
+          acked.notify_one();
+          on_ack(result);
+        }
+        // Stream closed: don't let the writer wait for acknowledgements.
+        boost::lock_guard<boost::mutex> lock(mutex);
+        in_flight = 0;
+        in_flight_batches.clear();
+        acked.notify_one();
+      });
+
+    mykafka::MessageBatch batch;
+    while (next(batch))
+    {
+      {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (in_flight > 0 && in_flight + batch.payloads_size() > window)
+          acked.wait(lock);
+        in_flight += batch.payloads_size();
+        in_flight_batches.push_back(batch.payloads_size());
+      }
+      if (!stream->Write(batch))
+        break;
+      batch.Clear();
+    }
+
+    stream->WritesDone();
+    reader.join();
+    return stream->Finish();
+  }
+
   grpc::Status
   Client::brokerInfo(mykafka::Void& request,
                      mykafka::BrokerInfoResponse& response,
@@ -6,7 +6,12 @@
 
 # include "mykafka.grpc.pb.h"
 
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/locks.hpp>
+# include <functional>
 # include <memory>
+# include <thread>
 
 namespace Network
 {
@@ -24,7 +29,13 @@ namespace Network
     ** @param address The server + port (server:port)
     ** @param client_connection_timeout Timeout for a query.
     */
-    Client(std::string address, int64_t client_connection_timeout = 200 /* ms */);
+    Client(std::string address, int64_t client_connection_timeout = 200 /* ms */,
+           int64_t max_in_flight = 1000);
+
+    /*!
+    ** Wait for the asynchronous calls in flight, and stop.
+    */
+    ~Client();
 
     /*!
     ** Force a reconnect. Already called internally, should'nt be called.
@@ -46,6 +57,19 @@ namespace Network
                              mykafka::SendMessageResponse& response,
                              bool try_reconnect = false);
 
+    /*!
+    ** Send batches of payloads to the broker, in one call.
+    **
+    ** @param request The message containing the batches.
+    ** @param response The server's answer.
+    ** @param try_reconnect Try to reconnect.
+    **
+    ** @return grpc::ok on succeed.
+    */
+    grpc::Status sendMessages(mykafka::SendMessagesRequest& request,
+                              mykafka::SendMessagesResponse& response,
+                              bool try_reconnect = false);
+
     /*!
     ** Get a payload from a given offset.
     **
@@ -59,6 +83,19 @@ namespace Network
                             mykafka::GetMessageResponse& response,
                             bool try_reconnect = false);
 
+    /*!
+    ** Get contiguous payloads from a given offset, in one call.
+    **
+    ** @param request The message containing the offset and the limits.
+    ** @param response The server's answer.
+    ** @param try_reconnect Try to reconnect.
+    **
+    ** @return grpc::ok on succeed.
+    */
+    grpc::Status getMessages(mykafka::GetMessagesRequest& request,
+                             mykafka::GetMessagesResponse& response,
+                             bool try_reconnect = false);
+
     /*!
     ** Create a topic/partition.
     **
@@ -111,6 +148,69 @@ namespace Network
                             mykafka::GetOffsetsResponse& response,
                             bool try_reconnect = false);
 
+    /*!
+    ** Subscribe to a topic/partition: receive the batches of records
+    ** as they are committed, until the callback returns false or
+    ** the broker ends the stream (the last batch carries the error).
+    ** Empty batches are sent by the broker when the partition is idle.
+    ** No timeout is applied to the stream.
+    **
+    ** @param request The topic/partition and the start offset.
+    ** @param callback Called for each batch, returns false to stop.
+    **
+    ** @return grpc::ok on succeed.
+    */
+    grpc::Status subscribe(mykafka::SubscribeRequest& request,
+                           const std::function<bool(const mykafka::GetMessagesResponse&)>& callback);
+
+    /*!
+    ** Asynchronous sendMessage: the call is started, and callback
+    ** is called with the result from the polling thread (it must
+    ** not block). Waits if max_in_flight calls are already in flight.
+    ** There is no reconnection: a failed call gives its status.
+    **
+    ** @param request The message containing the payload.
+    ** @param callback Called with the status and the server's answer.
+    */
+    void sendMessageAsync(const mykafka::SendMessageRequest& request,
+                          const std::function<void(const grpc::Status&,
+                                                   const mykafka::SendMessageResponse&)>& callback);
+
+    /*!
+    ** Asynchronous sendMessages, see sendMessageAsync.
+    **
+    ** @param request The message containing the batches.
+    ** @param callback Called with the status and the server's answer.
+    */
+    void sendMessagesAsync(const mykafka::SendMessagesRequest& request,
+                           const std::function<void(const grpc::Status&,
+                                                    const mykafka::SendMessagesResponse&)>& callback);
+
+    /*!
+    ** Get the number of asynchronous calls in flight.
+    **
+    ** @return The number of calls.
+    */
+    int64_t inFlight() const;
+
+    /*!
+    ** Produce on one stream: send the batches given by next while
+    ** at most window messages wait for their acknowledgement, and
+    ** call on_ack for each acknowledgement (in sending order, from
+    ** another thread). Stop once next returns false and all the
+    ** batches are acknowledged. No timeout is applied to the stream.
+    **
+    ** @param window The max number of messages not acknowledged
+    **          (a bigger batch is sent alone).
+    ** @param next Fill the next batch, returns false when done.
+    ** @param on_ack Called for each batch acknowledgement.
+    **
+    ** @return grpc::ok on succeed.
+    */
+    grpc::Status produce(int64_t window,
+                         const std::function<bool(mykafka::MessageBatch&)>& next,
+                         const std::function<void(const mykafka::MessageBatchResult&)>& on_ack);
+
     /*!
     ** Get info about a broker.
     **
@@ -124,12 +224,67 @@ namespace Network
                             mykafka::BrokerInfoResponse& response,
                             bool try_reconnect = false);
 
+  private:
+    /*!
+    ** @struct AsyncCall
+    **
+    ** An asynchronous call, tag of the completion queue.
+    */
+    struct AsyncCall
+    {
+      virtual ~AsyncCall() {}
+      virtual void done() = 0;
+
+      grpc::ClientContext context;
+      grpc::Status status;
+    };
+
+    template <typename Response>
+    struct AsyncResponseCall : public AsyncCall
+    {
+      typedef std::function<void(const grpc::Status&, const Response&)> callback_type;
+
+      AsyncResponseCall(const callback_type& cb)
+        : callback(cb)
+      {
+      }
+
+      void done() override
+      {
+        callback(status, response);
+      }
+
+      Response response;
+      std::unique_ptr<grpc::ClientAsyncResponseReader<Response> > reader;
+      callback_type callback;
+    };
+
+  private:
+    /*!
+    ** Wait for a free slot, then prepare a call (deadline,
+    ** polling thread started).
+    **
+    ** @param call The call to start.
+    */
+    void startCall(AsyncCall* call);
+
+    /*!
+    ** Polling thread: complete the calls.
+    */
+    void poll();
+
   private:
     const std::string address_;
     int64_t client_connection_timeout_;
     int64_t reconnect_timeout_;
     std::shared_ptr<grpc::Channel> channel_;
     std::unique_ptr<mykafka::Broker::Stub> stub_;
+    const int64_t max_in_flight_;
+    int64_t in_flight_;
+    grpc::CompletionQueue cq_;
+    std::thread poller_;
+    mutable boost::mutex async_mutex_;
+    boost::condition_variable slot_freed_;
   };
 } // Network
 
@@ -36,12 +36,22 @@ namespace Network
     */
     void process() override;
 
+  protected:
+    /*!
+    ** Retry the request once new data arrived (or timed out),
+    ** or end it as soon as the client is gone.
+    **
+    ** @param ok Unused.
+    */
+    void resume(bool ok) override;
+
   private:
     grpc::ServerContext ctx_;
     mykafka::GetMessageRequest request_;
     mykafka::GetMessageResponse response_;
     grpc::ServerAsyncResponseWriter<mykafka::GetMessageResponse> responder_;
     Broker::Broker& broker_;
+    int64_t watch_id_;
   };
 } // Network
 
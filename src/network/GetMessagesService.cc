@@ -0,0 +1,53 @@
+#include "network/GetMessagesService.hh"
+
+namespace Network
+{
+  GetMessagesService::GetMessagesService(Broker::Broker& broker,
+                                         std::shared_ptr<grpc::Service> service,
+                                         grpc::ServerCompletionQueue* cq)
+    : RpcService(service, cq), responder_(&ctx_), broker_(broker), watch_id_(-1)
+  {
+    notifyWhenDone(ctx_);
+    auto async_service = static_cast<mykafka::Broker::AsyncService*>(service.get());
+    async_service->RequestGetMessages(&ctx_, &request_, &responder_, cq, cq, this);
+  }
+
+  GetMessagesService::~GetMessagesService()
+  {
+  }
+
+  void
+  GetMessagesService::process()
+  {
+    new GetMessagesService(broker_, service_, cq_);
+    broker_.getMessages(request_, response_);
+
+    // Nothing to read yet: park the call until a write reaches the offset.
+    if (response_.error().code() == mykafka::Error::NO_MESSAGE && request_.max_wait_ms() > 0)
+    {
+      response_.Clear();
+      wait(request_.max_wait_ms(), [this]() {
+          broker_.watch(request_.topic(), request_.partition(), request_.offset(),
+                        watch_id_, [this]() { wakeUp(); });
+        });
+      return;
+    }
+    responder_.Finish(response_, grpc::Status::OK, this);
+  }
+
+  void
+  GetMessagesService::resume(bool)
+  {
+    broker_.unwatch(request_.topic(), request_.partition(), watch_id_);
+    watch_id_ = -1;
+
+    // The consumer is gone.
+    if (isCancelled())
+    {
+      responder_.FinishWithError(grpc::Status::CANCELLED, this);
+      return;
+    }
+    broker_.getMessages(request_, response_);
+    responder_.Finish(response_, grpc::Status::OK, this);
+  }
+} // Network
@@ -0,0 +1,58 @@
+#ifndef NETWORK_GETMESSAGESSERVICE_HH_
+# define NETWORK_GETMESSAGESSERVICE_HH_
+
+# include "network/RpcService.hh"
+# include "broker/Broker.hh"
+
+namespace Network
+{
+  /*!
+  ** @class GetMessagesService
+  **
+  ** Handle get messages (contiguous records).
+  */
+  class GetMessagesService : public RpcService
+  {
+  public:
+    /*!
+    ** Initialize a get messages service.
+    **
+    ** @param broker The broker.
+    ** @param service The rpc async service.
+    ** @param cq The async completion queue.
+    */
+    GetMessagesService(Broker::Broker& broker,
+                       std::shared_ptr<grpc::Service> service,
+                       grpc::ServerCompletionQueue* cq);
+
+    /*!
+    ** Destroy the service.
+    */
+    virtual ~GetMessagesService();
+
+    /*!
+    ** Handle the service.
+    ** Read a range of records from the commitlog, and returns them.
+    */
+    void process() override;
+
+  protected:
+    /*!
+    ** Retry the request once new data arrived (or timed out),
+    ** or end it as soon as the client is gone.
+    **
+    ** @param ok Unused.
+    */
+    void resume(bool ok) override;
+
+  private:
+    grpc::ServerContext ctx_;
+    mykafka::GetMessagesRequest request_;
+    mykafka::GetMessagesResponse response_;
+    grpc::ServerAsyncResponseWriter<mykafka::GetMessagesResponse> responder_;
+    Broker::Broker& broker_;
+    int64_t watch_id_;
+  };
+} // Network
+
+#endif /* !NETWORK_GETMESSAGESSERVICE_HH_ */
@@ -0,0 +1,56 @@
+#include "network/ProduceService.hh"
+
+namespace Network
+{
+  ProduceService::ProduceService(Broker::Broker& broker,
+                                 std::shared_ptr<grpc::Service> service,
+                                 grpc::ServerCompletionQueue* cq)
+    : RpcService(service, cq), stream_(&ctx_), broker_(broker), reading_(false)
+  {
+    auto async_service = static_cast<mykafka::Broker::AsyncService*>(service.get());
+    async_service->RequestProduce(&ctx_, &stream_, cq, cq, this);
+  }
+
+  ProduceService::~ProduceService()
+  {
+  }
+
+  void
+  ProduceService::process()
+  {
+    new ProduceService(broker_, service_, cq_);
+    reading_ = true;
+    keepAlive();
+    stream_.Read(&batch_, this);
+  }
+
+  void
+  ProduceService::resume(bool ok)
+  {
+    // Producer done (all its batches acknowledged), or gone.
+    if (!ok)
+    {
+      stream_.Finish(grpc::Status::OK, this);
+      return;
+    }
+
+    if (!reading_)
+    {
+      reading_ = true;
+      keepAlive();
+      stream_.Read(&batch_, this);
+      return;
+    }
+
+    // The acknowledgement is written once the writer appended the batch.
+    mykafka::SendMessagesRequest request;
+    request.add_batches()->Swap(&batch_);
+    response_.Clear();
+    broker_.sendMessages(request, response_, [this]() {
+        result_.Swap(response_.mutable_results(0));
+        reading_ = false;
+        keepAlive();
+        stream_.Write(result_, this);
+      });
+  }
+} // Network
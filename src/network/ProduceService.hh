@@ -0,0 +1,63 @@
+#ifndef NETWORK_PRODUCESERVICE_HH_
+# define NETWORK_PRODUCESERVICE_HH_
+
+# include "network/RpcService.hh"
+# include "broker/Broker.hh"
+
+namespace Network
+{
+  /*!
+  ** @class ProduceService
+  **
+  ** Handle produce: a stream of batches from one producer.
+  ** Each batch is appended in arrival order, then acknowledged
+  ** on the stream with its offset range. The batches sent in
+  ** the meantime wait in the grpc stream, so the producer
+  ** doesn't wait for an acknowledgement to send the next ones.
+  */
+  class ProduceService : public RpcService
+  {
+  public:
+    /*!
+    ** Initialize a produce service.
+    **
+    ** @param broker The broker.
+    ** @param service The rpc async service.
+    ** @param cq The async completion queue.
+    */
+    ProduceService(Broker::Broker& broker,
+                   std::shared_ptr<grpc::Service> service,
+                   grpc::ServerCompletionQueue* cq);
+
+    /*!
+    ** Destroy the service.
+    */
+    virtual ~ProduceService();
+
+    /*!
+    ** Handle the service.
+    ** Start to read the batches.
+    */
+    void process() override;
+
+  protected:
+    /*!
+    ** Append the batch just read and acknowledge it, or read
+    ** the next one once the acknowledgement is written.
+    **
+    ** @param ok False if the producer is done, or gone.
+    */
+    void resume(bool ok) override;
+
+  private:
+    grpc::ServerContext ctx_;
+    mykafka::MessageBatch batch_;
+    mykafka::SendMessagesResponse response_;
+    mykafka::MessageBatchResult result_;
+    grpc::ServerAsyncReaderWriter<mykafka::MessageBatchResult, mykafka::MessageBatch> stream_;
+    Broker::Broker& broker_;
+    bool reading_;
+  };
+} // Network
+
+#endif /* !NETWORK_PRODUCESERVICE_HH_ */
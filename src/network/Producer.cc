@@ -0,0 +1,246 @@
+#include "network/Producer.hh"
+
+#include <stdexcept>
+
+namespace Network
+{
+  Producer::Producer(Client& client, int64_t batch_size, int64_t linger_ms)
+    : client_(client), batch_size_(batch_size), linger_(linger_ms),
+      pending_(), in_flight_(), held_(), released_(), nb_batches_(0), nb_messages_(0), nb_bytes_(0), stop_(false),
+      mutex_(), changed_(), linger_thread_()
+  {
+    linger_thread_ = std::thread(&Producer::linger, this);
+  }
+
+  Producer::~Producer()
+  {
+    flush();
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    changed_.notify_one();
+    linger_thread_.join();
+  }
+
+  std::future<int64_t>
+  Producer::send(const std::string& topic, int32_t partition, const std::string& payload)
+  {
+    batches_type full;
+    std::future<int64_t> future;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+
+      auto found = pending_.find(std::make_pair(topic, partition));
+      if (found == pending_.end())
+      {
+        Batch batch;
+        batch.batch.set_topic(topic);
+        batch.batch.set_partition(partition);
+        batch.bytes = 0;
+        batch.deadline = clock::now() + linger_;
+        found = pending_.emplace(std::make_pair(topic, partition), std::move(batch)).first;
+        changed_.notify_one();
+      }
+
+      auto& batch = found->second;
+      batch.batch.add_payloads(payload);
+      batch.bytes += payload.size();
+      batch.promises.emplace_back();
+      future = batch.promises.back().get_future();
+
+      if (batch.bytes >= batch_size_)
+      {
+        full.push_back(std::move(batch));
+        pending_.erase(found);
+        holdBatches(full);
+      }
+    }
+
+    if (!full.empty())
+      sendBatches(std::move(full));
+    return future;
+  }
+
+  void
+  Producer::flush()
+  {
+    batches_type batches;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      takeBatches(true, batches);
+      holdBatches(batches);
+    }
+    if (!batches.empty())
+      sendBatches(std::move(batches));
+  }
+
+  int64_t
+  Producer::nbBatches() const
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return nb_batches_;
+  }
+
+  int64_t
+  Producer::nbMessages() const
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return nb_messages_;
+  }
+
+  double
+  Producer::batchFillRatio() const
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (nb_batches_ == 0 || batch_size_ <= 0)
+      return 0;
+    return static_cast<double>(nb_bytes_) / (nb_batches_ * batch_size_);
+  }
+
+  void
+  Producer::takeBatches(bool all, batches_type& batches)
+  {
+    const auto now = clock::now();
+    for (auto it = pending_.begin(); it != pending_.end();)
+    {
+      if (all || it->second.deadline <= now)
+      {
+        batches.push_back(std::move(it->second));
+        it = pending_.erase(it);
+      }
+      else
+        ++it;
+    }
+  }
+
+  void
+  Producer::holdBatches(batches_type& batches)
+  {
+    batches_type to_send;
+    for (auto& batch : batches)
+    {
+      const key_type key(batch.batch.topic(), batch.batch.partition());
+      if (in_flight_.insert(key).second)
+        to_send.push_back(std::move(batch));
+      else
+        held_[key].push_back(std::move(batch));
+    }
+    batches.swap(to_send);
+  }
+
+  void
+  Producer::release(const std::vector<key_type>& keys)
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    for (auto& key : keys)
+    {
+      auto found = held_.find(key);
+      if (found == held_.end())
+      {
+        in_flight_.erase(key);
+        continue;
+      }
+      // Still in flight, with the batches held (sent in one call, in order).
+      for (auto& batch : found->second)
+        released_.push_back(std::move(batch));
+      held_.erase(found);
+    }
+    // Notified with the lock held: the producer may be destroyed right after.
+    changed_.notify_one();
+  }
+
+  void
+  Producer::sendBatches(batches_type&& batches)
+  {
+    mykafka::SendMessagesRequest request;
+    std::vector<key_type> keys;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      for (auto& batch : batches)
+      {
+        ++nb_batches_;
+        nb_messages_ += batch.promises.size();
+        nb_bytes_ += batch.bytes;
+      }
+    }
+    for (auto& batch : batches)
+    {
+      keys.emplace_back(batch.batch.topic(), batch.batch.partition());
+      request.add_batches()->Swap(&batch.batch);
+    }
+
+    // std::function needs a copyable callback.
+    auto sent = std::make_shared<batches_type>(std::move(batches));
+    client_.sendMessagesAsync(request, [this, sent, keys](const grpc::Status& status,
+                                                          const mykafka::SendMessagesResponse& response) {
+        for (size_t i = 0; i < sent->size(); ++i)
+        {
+          auto& promises = (*sent)[i].promises;
+          std::string error;
+          if (!status.ok())
+            error = std::to_string(status.error_code()) + ": " + status.error_message();
+          else if (static_cast<int>(i) >= response.results_size())
+            error = "Missing batch result!";
+          else if (response.results(i).error().code() != mykafka::Error::OK)
+            error = std::to_string(response.results(i).error().code()) + ": " +
+              response.results(i).error().msg();
+
+          for (size_t j = 0; j < promises.size(); ++j)
+          {
+            if (error.empty())
+              promises[j].set_value(response.results(i).base_offset() + j);
+            else
+              promises[j].set_exception(std::make_exception_ptr(std::runtime_error(error)));
+          }
+        }
+        // Called from the client polling thread: the next batches are
+        // sent by the linger thread (a call can wait for a free slot).
+        release(keys);
+      });
+  }
+
+  void
+  Producer::linger()
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (!stop_ || !in_flight_.empty())
+    {
+      if (!released_.empty())
+      {
+        batches_type batches;
+        batches.swap(released_);
+        lock.unlock();
+        sendBatches(std::move(batches));
+        lock.lock();
+        continue;
+      }
+
+      if (pending_.empty() || stop_)
+      {
+        changed_.wait(lock);
+        continue;
+      }
+
+      auto deadline = clock::time_point::max();
+      for (auto& pending : pending_)
+        deadline = std::min(deadline, pending.second.deadline);
+      const auto now = clock::now();
+      if (deadline > now)
+      {
+        changed_.wait_for(lock, boost::chrono::microseconds(
+                            std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count()));
+        continue;
+      }
+
+      batches_type batches;
+      takeBatches(false, batches);
+      holdBatches(batches);
+      if (batches.empty())
+        continue;
+      lock.unlock();
+      sendBatches(std::move(batches));
+      lock.lock();
+    }
+  }
+} // Network
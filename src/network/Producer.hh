@@ -0,0 +1,160 @@
+#ifndef NETWORK_PRODUCER_HH_
+# define NETWORK_PRODUCER_HH_
+
+# include "network/Client.hh"
+
+# include <boost/thread/condition_variable.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/locks.hpp>
+# include <chrono>
+# include <future>
+# include <map>
+# include <memory>
+# include <set>
+# include <thread>
+# include <vector>
+
+namespace Network
+{
+  /*!
+  ** @class Producer
+  **
+  ** Batch the messages sent through a client, per topic/partition.
+  ** A batch is sent once it holds batch_size bytes, or once its
+  ** first message waited linger_ms. The batches ready together
+  ** are sent in one SendMessages call (asynchronous).
+  ** Only one call per topic/partition is in flight: the batches
+  ** ready meanwhile are kept back, and sent (together) once it is
+  ** acknowledged, so the batches of a partition are written in order.
+  */
+  class Producer
+  {
+  public:
+    /*!
+    ** Initialize a new producer.
+    **
+    ** @param client The client used to send the batches.
+    ** @param batch_size Size of a full batch (bytes).
+    ** @param linger_ms Max time a message waits for its batch to fill (ms).
+    */
+    Producer(Client& client, int64_t batch_size = 16 * 1024, int64_t linger_ms = 5);
+
+    /*!
+    ** Send the pending batches, wait for their acknowledgements
+    ** (all the futures are resolved), and stop.
+    */
+    ~Producer();
+
+    /*!
+    ** Add a message to the batch of its topic/partition.
+    **
+    ** @param topic The topic.
+    ** @param partition The partition.
+    ** @param payload The message.
+    **
+    ** @return The offset where the message is written. Holds a
+    **         std::runtime_error if it couldn't be written.
+    */
+    std::future<int64_t> send(const std::string& topic, int32_t partition,
+                              const std::string& payload);
+
+    /*!
+    ** Send all the pending batches now.
+    */
+    void flush();
+
+    /*!
+    ** Get the number of batches sent.
+    **
+    ** @return The number of batches.
+    */
+    int64_t nbBatches() const;
+
+    /*!
+    ** Get the number of messages sent.
+    **
+    ** @return The number of messages.
+    */
+    int64_t nbMessages() const;
+
+    /*!
+    ** Get the average fill ratio of the batches sent
+    ** (bytes sent / (batches * batch_size)).
+    **
+    ** @return The fill ratio.
+    */
+    double batchFillRatio() const;
+
+  private:
+    typedef std::chrono::steady_clock clock;
+    struct Batch
+    {
+      mykafka::MessageBatch batch;
+      int64_t bytes;
+      clock::time_point deadline;
+      std::vector<std::promise<int64_t> > promises;
+    };
+    typedef std::vector<Batch> batches_type;
+    typedef std::pair<std::string, int32_t> key_type;
+
+  private:
+    /*!
+    ** Remove from the pending batches the ones to send.
+    ** @warning The lock must be held.
+    **
+    ** @param all Take all the batches, or only the expired ones.
+    ** @param batches The batches to send.
+    */
+    void takeBatches(bool all, batches_type& batches);
+
+    /*!
+    ** Keep back the batches of the topic/partitions having a call
+    ** in flight, mark the other ones as in flight.
+    ** @warning The lock must be held.
+    **
+    ** @param batches The batches ready, only the ones to send are left.
+    */
+    void holdBatches(batches_type& batches);
+
+    /*!
+    ** Called once a call is acknowledged: the batches kept back for
+    ** its topic/partitions are handed to the linger thread.
+    **
+    ** @param keys The topic/partitions of the call.
+    */
+    void release(const std::vector<key_type>& keys);
+
+    /*!
+    ** Send batches in one call, and resolve their futures
+    ** once acknowledged.
+    **
+    ** @param batches The batches to send.
+    */
+    void sendBatches(batches_type&& batches);
+
+    /*!
+    ** Linger thread: send the batches reaching their deadline, and
+    ** the ones released by an acknowledgement. Stop once nothing
+    ** is in flight anymore.
+    */
+    void linger();
+
+  private:
+    Client& client_;
+    const int64_t batch_size_;
+    const std::chrono::milliseconds linger_;
+    std::map<key_type, Batch> pending_;
+    std::set<key_type> in_flight_;
+    std::map<key_type, batches_type> held_;
+    batches_type released_;
+    int64_t nb_batches_;
+    int64_t nb_messages_;
+    int64_t nb_bytes_;
+    bool stop_;
+    mutable boost::mutex mutex_;
+    boost::condition_variable changed_;
+    std::thread linger_thread_;
+  };
+} // Network
+
+#endif /* !NETWORK_PRODUCER_HH_ */
@@ -1,15 +1,18 @@
 #include "network/RpcServer.hh"
 #include "network/RpcService.hh"
 
+#include <chrono>
 #include <thread>
 #include <vector>
 
 namespace Network
 {
+  const int64_t RpcServer::SHUTDOWN_TIMEOUT_MS;
+
   RpcServer::RpcServer(std::string address,
                        std::shared_ptr<grpc::Service> service,
                        int32_t thread_number)
-    : started_(false),
+    : started_(false), shutdown_(false), mutex_(),
       thread_number_(thread_number ? thread_number : std::thread::hardware_concurrency()),
       address_(address), service_(service)
   {
@@ -17,23 +20,24 @@ namespace Network
 
   RpcServer::~RpcServer()
   {
-    if (started_)
-    {
-      server_->Shutdown();
-      // Always shutdown the completion queue after the server.
-      cq_->Shutdown();
-    }
+    shutdown();
   }
 
   void
   RpcServer::run()
   {
-    grpc::ServerBuilder builder;
-    builder.AddListeningPort(address_, grpc::InsecureServerCredentials());
-    builder.RegisterService(service_.get());
-    cq_ = builder.AddCompletionQueue();
-    server_ = builder.BuildAndStart();
-    started_ = true;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      if (shutdown_)
+        return;
+
+      grpc::ServerBuilder builder;
+      builder.AddListeningPort(address_, grpc::InsecureServerCredentials());
+      builder.RegisterService(service_.get());
+      cq_ = builder.AddCompletionQueue();
+      server_ = builder.BuildAndStart();
+      started_ = true;
+    }
 
     std::cout << "Server listening on " << address_
               << " using " << thread_number_ << " threads"
@@ -46,6 +50,23 @@ namespace Network
       thread.join();
   }
 
+  void
+  RpcServer::shutdown()
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (shutdown_)
+      return;
+
+    shutdown_ = true;
+    if (started_)
+    {
+      server_->Shutdown(std::chrono::system_clock::now() +
+                        std::chrono::milliseconds(SHUTDOWN_TIMEOUT_MS));
+      // Always shutdown the completion queue after the server.
+      cq_->Shutdown();
+    }
+  }
+
   void
   RpcServer::handleRpcs()
   {
@@ -53,15 +74,15 @@ namespace Network
     void* tag = 0;
     bool ok = false;
 
-    while (true)
-    {
-      // Block waiting to read the next event from the completion queue. The
-      // event is uniquely identified by its tag, which in this case is the
-      // memory address of a Service instance.
-      // The return value of Next should always be checked. This return value
-      // tells us whether there is any kind of event or cq_ is shutting down.
-      if (cq_->Next(&tag, &ok) && ok)
-        static_cast<RpcService*>(tag)->proceed();
-    }
+    // Block waiting to read the next event from the completion queue. The
+    // event is uniquely identified by its tag, which in this case is the
+    // memory address of a Service instance.
+    // The return value of Next should always be checked. This return value
+    // tells us whether there is any kind of event or cq_ is shutting down
+    // (and drained: the thread is done).
+    // ok is false for a cancelled alarm (parked call woken up),
+    // or a call interrupted by the shutdown.
+    while (cq_->Next(&tag, &ok))
+      static_cast<RpcService*>(tag)->proceed(ok);
   }
 } // Network
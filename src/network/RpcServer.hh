@@ -3,6 +3,7 @@
 
 # include <grpc++/grpc++.h>
 # include <grpc/support/log.h>
+# include <boost/thread/mutex.hpp>
 
 # include "mykafka.grpc.pb.h"
 
@@ -35,10 +36,23 @@ namespace Network
     virtual ~RpcServer();
 
     /*!
-    ** Launch the server and start to listen.
+    ** Launch the server and start to listen, until shutdown.
     */
     void run();
 
+    /*!
+    ** Shutdown the server: the calls in progress are cancelled
+    ** after SHUTDOWN_TIMEOUT_MS, then run returns once the
+    ** completion queue is drained. Can be called from any
+    ** thread, before or during run.
+    */
+    void shutdown();
+
+    /*!
+    ** Max time given to the calls in progress on shutdown (ms).
+    */
+    static const int64_t SHUTDOWN_TIMEOUT_MS = 5000;
+
   protected:
     /*!
     ** Handle all services.
@@ -52,6 +66,8 @@ namespace Network
 
   protected:
     bool started_;
+    bool shutdown_;
+    boost::mutex mutex_;
     int32_t thread_number_;
     const std::string address_;
     std::unique_ptr<grpc::ServerCompletionQueue> cq_;
@@ -2,9 +2,33 @@
 
 namespace Network
 {
+  const int64_t RpcService::MAX_WAIT_MS;
+
+  /*!
+  ** @class DoneTag
+  **
+  ** Completion queue tag of AsyncNotifyWhenDone, notifying its owner.
+  */
+  class RpcService::DoneTag : public RpcService
+  {
+  public:
+    DoneTag(RpcService* owner)
+      : RpcService(owner->service_, owner->cq_)
+    {
+      owner_ = owner;
+    }
+
+  protected:
+    void process() override
+    {
+    }
+  };
+
   RpcService::RpcService(std::shared_ptr<grpc::Service> service,
                          grpc::ServerCompletionQueue* cq)
-    : service_(service), cq_(cq), status_(PROCESS)
+    : service_(service), cq_(cq), status_(PROCESS), alarm_(), owner_(nullptr),
+      done_tag_(nullptr), done_ctx_(nullptr), finished_(false), cancelled_(false),
+      wait_mutex_()
   {
   }
 
@@ -13,17 +37,114 @@ namespace Network
   }
 
   void
-  RpcService::proceed()
+  RpcService::proceed(bool ok)
   {
-    if (status_ == PROCESS)
+    if (owner_)
+    {
+      owner_->done();
+      delete this;
+    }
+    else if (status_ == PROCESS && ok)
     {
       status_ = FINISH;
       process();
     }
+    else if (status_ == WAIT)
+    {
+      {
+        // Wait for the wake up to be registered.
+        boost::lock_guard<boost::mutex> lock(wait_mutex_);
+        status_ = FINISH;
+      }
+      resume(true);
+    }
+    else if (status_ == STREAM)
+    {
+      status_ = FINISH;
+      resume(ok);
+    }
     else
     {
-      GPR_ASSERT(status_ == FINISH);
-      delete this;
+      GPR_ASSERT(status_ == FINISH || !ok);
+      release();
+    }
+  }
+
+  void
+  RpcService::resume(bool)
+  {
+  }
+
+  void
+  RpcService::wait(int64_t max_wait_ms, const std::function<void()>& setup)
+  {
+    boost::lock_guard<boost::mutex> lock(wait_mutex_);
+
+    status_ = WAIT;
+    const int64_t wait_ms = std::min(max_wait_ms, MAX_WAIT_MS);
+    alarm_.reset(new grpc::Alarm());
+    alarm_->Set(cq_, std::chrono::system_clock::now() + std::chrono::milliseconds(wait_ms), this);
+    setup();
+    if (cancelled_)
+      alarm_->Cancel();
+  }
+
+  void
+  RpcService::wakeUp()
+  {
+    alarm_->Cancel();
+  }
+
+  void
+  RpcService::keepAlive()
+  {
+    status_ = STREAM;
+  }
+
+  void
+  RpcService::notifyWhenDone(grpc::ServerContext& ctx)
+  {
+    done_ctx_ = &ctx;
+    done_tag_ = new DoneTag(this);
+    ctx.AsyncNotifyWhenDone(done_tag_);
+  }
+
+  bool
+  RpcService::isCancelled() const
+  {
+    boost::lock_guard<boost::mutex> lock(wait_mutex_);
+    return cancelled_;
+  }
+
+  void
+  RpcService::done()
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(wait_mutex_);
+      done_tag_ = nullptr;
+      cancelled_ = done_ctx_->IsCancelled();
+      if (!finished_)
+      {
+        // A parked call doesn't wait for its timeout to see it.
+        if (cancelled_ && status_ == WAIT)
+          alarm_->Cancel();
+        return;
+      }
+    }
+    delete this;
+  }
+
+  void
+  RpcService::release()
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(wait_mutex_);
+      finished_ = true;
+      // The done tag is only delivered for a call which started.
+      if (done_tag_ && status_ != PROCESS)
+        return;
     }
+    delete done_tag_;
+    delete this;
   }
 } // Network
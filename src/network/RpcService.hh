@@ -2,7 +2,13 @@
 # define NETWORK_RPCSERVICE_HH_
 
 # include <grpc++/grpc++.h>
+# include <grpc++/alarm.h>
 # include <grpc/support/log.h>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/locks.hpp>
+# include <atomic>
+# include <functional>
+# include <memory>
 
 # include "mykafka.grpc.pb.h"
 
@@ -33,8 +39,15 @@ namespace Network
     ** Spawn a new Service instance to serve new clients.
     ** This instance will deallocate itself as
     ** part of its FINISH state.
+    **
+    ** @param ok False if the event was cancelled.
     */
-    void proceed();
+    void proceed(bool ok);
+
+    /*!
+    ** Max time a call can be parked (ms).
+    */
+    static const int64_t MAX_WAIT_MS = 30000;
 
   protected:
     /*!
@@ -42,13 +55,85 @@ namespace Network
     */
     virtual void process() = 0;
 
+    /*!
+    ** Called when a parked call is woken up (or timed out), or when
+    ** the read/write of a streaming call completed.
+    ** Has to be override by the services calling wait or keepAlive.
+    **
+    ** @param ok False if the read/write failed (stream closed).
+    */
+    virtual void resume(bool ok);
+
+    /*!
+    ** Park the call, without holding a thread, until wakeUp
+    ** is called or max_wait_ms elapsed. Then resume is called.
+    ** Has to be called from process or resume, instead of finishing
+    ** the call.
+    **
+    ** @param max_wait_ms The max time to wait (ms).
+    ** @param setup Function registering the wake up (called
+    **          before resume can be called).
+    */
+    void wait(int64_t max_wait_ms, const std::function<void()>& setup);
+
+    /*!
+    ** Wake up a parked call. Can be called from any thread,
+    ** until resume is called.
+    */
+    void wakeUp();
+
+    /*!
+    ** Keep a streaming call alive: the next event (a read or
+    ** write completion) calls resume, instead of ending the call.
+    ** Has to be called before starting the read/write.
+    */
+    void keepAlive();
+
+    /*!
+    ** Be notified as soon as the client is gone (call cancelled):
+    ** a parked call is woken up, and isCancelled returns true.
+    ** Has to be called before requesting the call.
+    **
+    ** @param ctx The server context of the call.
+    */
+    void notifyWhenDone(grpc::ServerContext& ctx);
+
+    /*!
+    ** Check if the call has been cancelled (see notifyWhenDone).
+    **
+    ** @return True if the client is gone.
+    */
+    bool isCancelled() const;
+
+  private:
+    class DoneTag;
+
+    /*!
+    ** Called by the done tag, once the call is done (finished or
+    ** cancelled). Delete the service if it's finished already.
+    */
+    void done();
+
+    /*!
+    ** Delete the finished service, unless its done tag is still
+    ** pending (then deleted by done).
+    */
+    void release();
+
   protected:
     std::shared_ptr<grpc::Service> service_;
     grpc::ServerCompletionQueue* cq_;
 
   private:
-    enum CallStatus { PROCESS, FINISH };
-    CallStatus status_;
+    enum CallStatus { PROCESS, WAIT, STREAM, FINISH };
+    std::atomic<CallStatus> status_;
+    std::unique_ptr<grpc::Alarm> alarm_;
+    RpcService* owner_; // Set for a done tag only
+    RpcService* done_tag_;
+    grpc::ServerContext* done_ctx_;
+    bool finished_;
+    bool cancelled_;
+    mutable boost::mutex wait_mutex_;
   };
 } // Network
 
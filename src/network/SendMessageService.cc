@@ -19,7 +19,8 @@ namespace Network
   SendMessageService::process()
   {
     new SendMessageService(broker_, service_, cq_);
-    broker_.sendMessage(request_, response_);
-    responder_.Finish(response_, grpc::Status::OK, this);
+    broker_.sendMessage(request_, response_, [this]() {
+        responder_.Finish(response_, grpc::Status::OK, this);
+      });
   }
 } // Network
@@ -0,0 +1,26 @@
+#include "network/SendMessagesService.hh"
+
+namespace Network
+{
+  SendMessagesService::SendMessagesService(Broker::Broker& broker,
+                                           std::shared_ptr<grpc::Service> service,
+                                           grpc::ServerCompletionQueue* cq)
+    : RpcService(service, cq), responder_(&ctx_), broker_(broker)
+  {
+    auto async_service = static_cast<mykafka::Broker::AsyncService*>(service.get());
+    async_service->RequestSendMessages(&ctx_, &request_, &responder_, cq, cq, this);
+  }
+
+  SendMessagesService::~SendMessagesService()
+  {
+  }
+
+  void
+  SendMessagesService::process()
+  {
+    new SendMessagesService(broker_, service_, cq_);
+    broker_.sendMessages(request_, response_, [this]() {
+        responder_.Finish(response_, grpc::Status::OK, this);
+      });
+  }
+} // Network
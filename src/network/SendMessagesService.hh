@@ -0,0 +1,48 @@
+#ifndef NETWORK_SENDMESSAGESSERVICE_HH_
+# define NETWORK_SENDMESSAGESSERVICE_HH_
+
+# include "network/RpcService.hh"
+# include "broker/Broker.hh"
+
+namespace Network
+{
+  /*!
+  ** @class SendMessagesService
+  **
+  ** Handle send messages (batches of payloads).
+  */
+  class SendMessagesService : public RpcService
+  {
+  public:
+    /*!
+    ** Initialize a send messages service.
+    **
+    ** @param broker The broker.
+    ** @param service The rpc async service.
+    ** @param cq The async completion queue.
+    */
+    SendMessagesService(Broker::Broker& broker,
+                        std::shared_ptr<grpc::Service> service,
+                        grpc::ServerCompletionQueue* cq);
+
+    /*!
+    ** Destroy the service.
+    */
+    virtual ~SendMessagesService();
+
+    /*!
+    ** Handle the service.
+    ** Append each batch to its partition, and returns the base offsets.
+    */
+    void process() override;
+
+  private:
+    grpc::ServerContext ctx_;
+    mykafka::SendMessagesRequest request_;
+    mykafka::SendMessagesResponse response_;
+    grpc::ServerAsyncResponseWriter<mykafka::SendMessagesResponse> responder_;
+    Broker::Broker& broker_;
+  };
+} // Network
+
+#endif /* !NETWORK_SENDMESSAGESSERVICE_HH_ */
@@ -0,0 +1,86 @@
+#include "network/SubscribeService.hh"
+
+namespace Network
+{
+  SubscribeService::SubscribeService(Broker::Broker& broker,
+                                     std::shared_ptr<grpc::Service> service,
+                                     grpc::ServerCompletionQueue* cq)
+    : RpcService(service, cq), writer_(&ctx_), broker_(broker), offset_(0), watch_id_(-1), waited_(false)
+  {
+    notifyWhenDone(ctx_);
+    auto async_service = static_cast<mykafka::Broker::AsyncService*>(service.get());
+    async_service->RequestSubscribe(&ctx_, &request_, &writer_, cq, cq, this);
+  }
+
+  SubscribeService::~SubscribeService()
+  {
+  }
+
+  void
+  SubscribeService::process()
+  {
+    new SubscribeService(broker_, service_, cq_);
+    offset_ = request_.start_offset();
+    next();
+  }
+
+  void
+  SubscribeService::resume(bool ok)
+  {
+    if (watch_id_ >= 0)
+    {
+      broker_.unwatch(request_.topic(), request_.partition(), watch_id_);
+      watch_id_ = -1;
+    }
+
+    // The consumer is gone.
+    if (!ok || isCancelled())
+    {
+      writer_.Finish(grpc::Status::CANCELLED, this);
+      return;
+    }
+    next();
+  }
+
+  void
+  SubscribeService::next()
+  {
+    mykafka::GetMessagesRequest request;
+    request.set_topic(request_.topic());
+    request.set_partition(request_.partition());
+    request.set_offset(offset_);
+    request.set_max_bytes(request_.max_batch_bytes());
+    response_.Clear();
+    broker_.getMessages(request, response_);
+
+    switch (response_.error().code())
+    {
+      case mykafka::Error::OK:
+        waited_ = false;
+        offset_ += response_.records_size();
+        keepAlive();
+        writer_.Write(response_, this);
+        break;
+      case mykafka::Error::NO_MESSAGE:
+        if (waited_)
+        {
+          // Nothing committed during the wait: send an empty batch, the
+          // write fails if the consumer is gone, which ends the call.
+          waited_ = false;
+          response_.Clear();
+          keepAlive();
+          writer_.Write(response_, this);
+          break;
+        }
+        waited_ = true;
+        wait(MAX_WAIT_MS, [this]() {
+            broker_.watch(request_.topic(), request_.partition(), offset_,
+                          watch_id_, [this]() { wakeUp(); });
+          });
+        break;
+      default:
+        // Unknown partition, deleted offset...: the error ends the stream.
+        writer_.WriteAndFinish(response_, grpc::WriteOptions(), grpc::Status::OK, this);
+    }
+  }
+} // Network
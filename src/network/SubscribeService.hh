@@ -0,0 +1,74 @@
+#ifndef NETWORK_SUBSCRIBESERVICE_HH_
+# define NETWORK_SUBSCRIBESERVICE_HH_
+
+# include "network/RpcService.hh"
+# include "broker/Broker.hh"
+
+namespace Network
+{
+  /*!
+  ** @class SubscribeService
+  **
+  ** Handle subscribe: stream the records of a partition,
+  ** batch after batch, as they are committed.
+  ** Only one write is pending at a time, so a slow consumer
+  ** slows the reads down (grpc flow control) instead of
+  ** being buffered. A consumer gone is noticed at once (the
+  ** call is cancelled): a parked call is woken up, and stops
+  ** watching its partition. An empty batch is still sent when
+  ** nothing was committed for MAX_WAIT_MS (keep-alive).
+  */
+  class SubscribeService : public RpcService
+  {
+  public:
+    /*!
+    ** Initialize a subscribe service.
+    **
+    ** @param broker The broker.
+    ** @param service The rpc async service.
+    ** @param cq The async completion queue.
+    */
+    SubscribeService(Broker::Broker& broker,
+                     std::shared_ptr<grpc::Service> service,
+                     grpc::ServerCompletionQueue* cq);
+
+    /*!
+    ** Destroy the service.
+    */
+    virtual ~SubscribeService();
+
+    /*!
+    ** Handle the service.
+    ** Start to stream from the start offset.
+    */
+    void process() override;
+
+  protected:
+    /*!
+    ** Send the next batch, once the previous one is written
+    ** or new data arrived.
+    **
+    ** @param ok False if the previous write failed.
+    */
+    void resume(bool ok) override;
+
+  private:
+    /*!
+    ** Read and write the next batch, wait for it if not
+    ** committed yet, or end the stream on error.
+    */
+    void next();
+
+  private:
+    grpc::ServerContext ctx_;
+    mykafka::SubscribeRequest request_;
+    mykafka::GetMessagesResponse response_;
+    grpc::ServerAsyncWriter<mykafka::GetMessagesResponse> writer_;
+    Broker::Broker& broker_;
+    int64_t offset_;
+    int64_t watch_id_;
+    bool waited_;
+  };
+} // Network
+
+#endif /* !NETWORK_SUBSCRIBESERVICE_HH_ */
@@ -69,7 +69,9 @@ namespace Utils
 
   mykafka::Error
   ConfigManager::create(const TopicPartition& key,
-                        int64_t seg_size, int64_t part_size, int64_t ttl)
+                        int64_t seg_size, int64_t part_size, int64_t ttl,
+                        int64_t index_interval, int64_t flush_messages,
+                        int64_t flush_ms)
   {
     boost::lock_guard<boost::mutex> lock(mutex_);
 
@@ -133,7 +135,7 @@ namespace Utils
                         path + " because: " + std::string(::strerror(errno)));
     }
 
-    info.info = {seg_size, part_size, ttl, -1};
+    info.info = {seg_size, part_size, ttl, -1, index_interval, flush_messages, flush_ms};
     *reinterpret_cast<RawInfo*>(info.addr_) = info.info;
     configs_.insert(std::make_pair(key, info));
 
@@ -156,6 +158,17 @@ namespace Utils
                         path + " because: " + std::string(::strerror(errno)));
 
     const int64_t size = sizeof (RawInfo);
+    struct stat buf;
+    if (::fstat(info.fd_, &buf) < 0 || (buf.st_size < size && ::ftruncate(info.fd_, size) < 0))
+    {
+      if (::close(info.fd_) < 0)
+        return Utils::err(mykafka::Error::FILE_ERROR,
+                          "Can't close during failed resize config file " +
+                          path + " because: " + std::string(::strerror(errno)));
+      return Utils::err(mykafka::Error::FILE_ERROR, "Can't resize config file " +
+                        path + " because: " + std::string(::strerror(errno)));
+    }
+
     info.addr_ = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, info.fd_, 0);
     if (info.addr_ == MAP_FAILED)
     {
@@ -299,6 +312,9 @@ namespace Utils
           << ", max_part_size: " << entry.second.info.max_partition_size
           << ", segment_ttl: " << entry.second.info.segment_ttl
           << ", commit_offset: " << entry.second.info.commit_offset
+          << ", index_interval_bytes: " << entry.second.info.index_interval_bytes
+          << ", flush_messages: " << entry.second.info.flush_messages
+          << ", flush_ms: " << entry.second.info.flush_ms
           << std::endl;
   }
 } // Utils
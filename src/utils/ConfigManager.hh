@@ -58,6 +58,9 @@ namespace Utils
       int64_t max_partition_size;
       int64_t segment_ttl;
       int64_t commit_offset;
+      int64_t index_interval_bytes;
+      int64_t flush_messages;
+      int64_t flush_ms;
     } __attribute__((packed));
 
     /*!
@@ -120,14 +123,21 @@ namespace Utils
     ** @param seg_size The max segment size.
     ** @param part_size The max partition size.
     ** @param ttl The segment ttl.
+    ** @param index_interval The index interval in bytes (0 = dense index).
+    ** @param flush_messages Flush every N messages (0 = disabled).
+    ** @param flush_ms Flush every N ms (0 = disabled).
     **
     ** @return Error code 0 if no error, or a detailed error.
     */
     mykafka::Error create(const TopicPartition& key,
-                          int64_t seg_size, int64_t part_size, int64_t ttl);
+                          int64_t seg_size, int64_t part_size, int64_t ttl,
+                          int64_t index_interval = 0, int64_t flush_messages = 0,
+                          int64_t flush_ms = 0);
 
     /*!
     ** Open an existing config file.
+    ** Files written by an older version (smaller RawInfo)
+    ** are extended, new fields are zeroed.
     ** @warning Filename must exists !
     **
     ** @param key The topic/partition key.
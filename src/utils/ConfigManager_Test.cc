@@ -10,6 +10,7 @@
 
 #include <inttypes.h>
 #include <array>
+#include <fstream>
 
 namespace
 {
@@ -158,3 +159,72 @@ BOOST_FIXTURE_TEST_CASE(test_update_commit_offset, Setup)
   res = config.close();
   BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
 }
+
+BOOST_FIXTURE_TEST_CASE(test_index_interval, Setup)
+{
+  {
+    Utils::ConfigManager config(tmp_path);
+    auto res = config.create({"sparse", 0}, 1, 2, 3, 4096);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+
+  Utils::ConfigManager config(tmp_path);
+  auto res = config.open({"sparse", 0});
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  Utils::ConfigManager::RawInfo info;
+  res = config.get({"sparse", 0}, info);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(info.segment_ttl, 3);
+  BOOST_CHECK_EQUAL(info.index_interval_bytes, 4096);
+
+  res = config.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_flush_policy, Setup)
+{
+  {
+    Utils::ConfigManager config(tmp_path);
+    auto res = config.create({"flushed", 0}, 1, 2, 3, 0, 100, 50);
+    BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  }
+
+  Utils::ConfigManager config(tmp_path);
+  auto res = config.open({"flushed", 0});
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  Utils::ConfigManager::RawInfo info;
+  res = config.get({"flushed", 0}, info);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(info.flush_messages, 100);
+  BOOST_CHECK_EQUAL(info.flush_ms, 50);
+
+  res = config.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_open_old_conf, Setup)
+{
+  // Config written before index_interval_bytes existed.
+  {
+    const int64_t old_info[4] = {1, 2, 3, 713};
+    std::ofstream file(tmp_path + "/old-0.cfg", std::ios::binary);
+    file.write(reinterpret_cast<const char*>(old_info), sizeof (old_info));
+  }
+
+  Utils::ConfigManager config(tmp_path);
+  auto res = config.open({"old", 0});
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  Utils::ConfigManager::RawInfo info;
+  res = config.get({"old", 0}, info);
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+  BOOST_CHECK_EQUAL(info.max_segment_size, 1);
+  BOOST_CHECK_EQUAL(info.commit_offset, 713);
+  BOOST_CHECK_EQUAL(info.index_interval_bytes, 0);
+  BOOST_CHECK_EQUAL(info.flush_messages, 0);
+  BOOST_CHECK_EQUAL(info.flush_ms, 0);
+  BOOST_CHECK_EQUAL(fs::file_size(tmp_path + "/old-0.cfg"),
+                    sizeof (Utils::ConfigManager::RawInfo));
+
+  res = config.close();
+  BOOST_CHECK_EQUAL_MSG(res.code(), mykafka::Error::OK, res.msg());
+}
@@ -0,0 +1,96 @@
+#ifndef UTILS_MPSCQUEUE_HH_
+# define UTILS_MPSCQUEUE_HH_
+
+# include <algorithm>
+# include <atomic>
+# include <vector>
+
+namespace Utils
+{
+  /*!
+  ** @class MpscQueue
+  **
+  ** Lock-free multi producers, single consumer queue.
+  ** Producers push with a compare-and-swap on the head of a
+  ** linked list. The consumer takes the whole list at once
+  ** (one exchange), and gets the values in push order.
+  */
+  template <typename T>
+  class MpscQueue
+  {
+  public:
+    MpscQueue()
+      : head_(nullptr)
+    {
+    }
+
+    ~MpscQueue()
+    {
+      std::vector<T> values;
+      popAll(values);
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /*!
+    ** Push a value. Can be called from any thread.
+    **
+    ** @param value The value.
+    **
+    ** @return True if the queue was empty (the consumer may
+    **         have to be woken up).
+    */
+    bool push(T&& value)
+    {
+      Node* node = new Node{std::move(value), head_.load(std::memory_order_relaxed)};
+      while (!head_.compare_exchange_weak(node->next, node,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+        ;
+      return node->next == nullptr;
+    }
+
+    /*!
+    ** Take all the values pushed so far.
+    ** @warning Only one thread can consume.
+    **
+    ** @param values Where to append the values (in push order).
+    */
+    void popAll(std::vector<T>& values)
+    {
+      Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+      const size_t first = values.size();
+      while (node)
+      {
+        Node* next = node->next;
+        values.push_back(std::move(node->value));
+        delete node;
+        node = next;
+      }
+      std::reverse(values.begin() + first, values.end());
+    }
+
+    /*!
+    ** Check if the queue is empty.
+    **
+    ** @return True if nothing is pushed.
+    */
+    bool empty() const
+    {
+      return head_.load(std::memory_order_acquire) == nullptr;
+    }
+
+  private:
+    struct Node
+    {
+      T value;
+      Node* next;
+    };
+
+  private:
+    std::atomic<Node*> head_;
+  };
+} // Utils
+
+#endif /* !UTILS_MPSCQUEUE_HH_ */
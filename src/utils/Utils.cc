@@ -1,5 +1,10 @@
 #include "utils/Utils.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 namespace Utils
 {
   int64_t roundDownToMultiple(int64_t value, int64_t factor)
@@ -7,6 +12,39 @@ namespace Utils
     return value - (value % factor);
   }
 
+  int64_t roundUpToMultiple(int64_t value, int64_t factor)
+  {
+    return roundDownToMultiple(value + factor - 1, factor);
+  }
+
+  void parallelFor(int64_t nb_tasks, int32_t nb_threads,
+                   const std::function<void(int64_t)>& task)
+  {
+    if (nb_threads <= 0)
+      nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    nb_threads = std::min<int64_t>(nb_threads, nb_tasks);
+
+    std::atomic<int64_t> next(0);
+    auto worker = [&]()
+      {
+        for (int64_t i = next++; i < nb_tasks; i = next++)
+          task(i);
+      };
+
+    if (nb_threads <= 1)
+    {
+      worker();
+      return;
+    }
+
+    std::vector<std::thread> threads;
+    for (int32_t i = 1; i < nb_threads; ++i)
+      threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+      thread.join();
+  }
+
   mykafka::Error err(mykafka::Error_ErrCode code, const std::string& msg)
   {
     mykafka::Error error;
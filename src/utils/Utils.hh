@@ -3,6 +3,7 @@
 
 # include "mykafka.pb.h"
 
+# include <functional>
 # include <sstream>
 # include <inttypes.h>
 
@@ -19,6 +20,30 @@ namespace Utils
   */
   int64_t roundDownToMultiple(int64_t value, int64_t factor);
 
+  /*!
+  ** Round up to the nearest multiple.
+  ** Ex: (238, 8) => 240
+  **
+  ** @param value The value to round.
+  ** @param factor The factor.
+  **
+  ** @return Rounded value.
+  */
+  int64_t roundUpToMultiple(int64_t value, int64_t factor);
+
+  /*!
+  ** Run task(0) .. task(nb_tasks - 1) on a bounded pool of threads.
+  ** Each thread picks the next task until none is left. Returns
+  ** when every task is done. With one thread (or one task), tasks
+  ** run in order on the calling thread.
+  **
+  ** @param nb_tasks The number of tasks.
+  ** @param nb_threads The max number of threads (0 = nb machine core).
+  ** @param task The task to run, given its index.
+  */
+  void parallelFor(int64_t nb_tasks, int32_t nb_threads,
+                   const std::function<void(int64_t)>& task);
+
   /*!
   ** Help to create an error message from a code and a message.
   **